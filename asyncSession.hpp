@@ -1,11 +1,14 @@
 #ifndef ASYNC_SESSON_HPP
 #define ASYNC_SESSON_HPP
+//include build options
+#include "httpConfig.hpp"
 //include beast
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
-//include strand
-#include <boost/asio/strand.hpp>
+//include shared loop, pool and caches
+#include "clientContext.hpp"
+#include "requestHandle.hpp"
 //include others
 #include <iostream>
 #include <string>
@@ -16,50 +19,64 @@ namespace net = boost::asio;
 using tcp = boost::asio::ip::tcp;     
 
 
-// Performs an HTTP GET and prints the response
+// Performs an HTTP request on the shared client loop, reusing
+// a pooled connection when one is idle for the host
 class AsyncSession : public std::enable_shared_from_this<AsyncSession>
 {
+    ClientContext& context_;
     tcp::resolver resolver_;
-    beast::tcp_stream stream_;
+    std::unique_ptr<PlainStream> stream_;
     beast::flat_buffer buffer_;
     http::request<http::empty_body> empty_req_;
     http::request<http::string_body> loaded_req_;
     std::string req_type_;
-    http::response<http::string_body> res_;
-    std::function<void(std::string)> callback_;
+    http::response<padded_body> res_;
+    ResponseHandler callback_;
+    std::string host_;
+    std::string port_;
+    std::string key_;
+    bool reused_ = false;
+    std::shared_ptr<RequestState> state_;
+    std::shared_ptr<EndpointRacer> racer_;
+    tcp::endpoint endpoint_;
+    std::chrono::steady_clock::time_point sent_at_;
+    bool measuring_ = false;
+    bool warm_ = false;
+    ZerocopyTracker zerocopy_;
+    bool reusable_ = true;
+    FlightTrace flight_;
     
     public:
-    // Objects are constructed with a strand to
-    // ensure that handlers do not execute concurrently.
+    // All handlers run on the context's single loop thread, which
+    // serializes them the same way a strand would.
     explicit
-    AsyncSession(net::io_context& ioc)
-        : resolver_(net::make_strand(ioc))
-        , stream_(net::make_strand(ioc))
+    AsyncSession(ClientContext& context)
+        : context_(context)
+        , resolver_(context.io())
     {
     }
 
+    // A session dropped with its loop must not leave waiters hanging
+    ~AsyncSession()
+    {
+        if(state_)
+            state_->complete(net::error::operation_aborted);
+    }
+
     // Start the asynchronous operation
     void
     run(
         char const* host,
         char const* port,
         const http::request<http::empty_body>& request,
-        std::function<void(std::string)> callback
+        ResponseHandler callback,
+        std::shared_ptr<RequestState> state
     ){
         empty_req_ = request;
         callback_ = callback;
         req_type_ = "empty";
-
-
-        // Look up the domain name
-        resolver_.async_resolve(
-            host,
-            port,
-            beast::bind_front_handler(
-                &AsyncSession::on_resolve,
-                shared_from_this()
-            )
-        );
+        state_ = state;
+        start(host, port);
     }
 
     void
@@ -67,17 +84,94 @@ class AsyncSession : public std::enable_shared_from_this<AsyncSession>
         char const* host,
         char const* port,
         const http::request<http::string_body>& request,
-        std::function<void(std::string)> callback
+        ResponseHandler callback,
+        std::shared_ptr<RequestState> state
     ){
         loaded_req_ = request;
         callback_ = callback;
         req_type_ = "loaded";
+        state_ = state;
+        start(host, port);
+    }
 
+    // Open a connection and park it in the pool instead of sending a
+    // request, so a later request skips the setup
+    void
+    warm(
+        char const* host,
+        char const* port,
+        std::shared_ptr<RequestState> state
+    ){
+        warm_ = true;
+        state_ = state;
+        start(host, port);
+    }
+
+    void
+    start(char const* host, char const* port)
+    {
+        host_ = host;
+        port_ = port;
+        key_ = port_ + "://" + host_;
+
+        // Cancelling the handle aborts whatever step is in flight on the loop
+        std::weak_ptr<AsyncSession> weak = shared_from_this();
+        state_->on_cancel([weak, &io = context_.io()]{
+            net::post(io, [weak]{
+                if(auto self = weak.lock())
+                    self->abort();
+            });
+        });
+
+        // Hop onto the loop before touching the stream
+        net::dispatch(
+            context_.io(),
+            beast::bind_front_handler(
+                &AsyncSession::on_start,
+                shared_from_this()
+            )
+        );
+    }
+
+    void
+    on_start()
+    {
+        if(state_->cancelled())
+            return finish({}, "start");
+
+        // A warm-up always opens a new connection
+        if(warm_)
+            return connect();
+
+        // Trace the request if the context records them
+        flight_ = FlightTrace(context_.flight_recorder(), host_);
+
+        // Read the response into a recycled buffer
+        res_.body() = context_.pool().buffers().acquire();
+
+        // Skip resolve and connect when an idle connection is pooled
+        stream_ = context_.pool().acquire<PlainStream>(key_, context_.scorer());
+        reused_ = stream_ != nullptr;
+        if(reused_){
+            flight_.record(FlightEvent::pool_reuse);
+            return send();
+        }
+
+        connect();
+    }
+
+    void
+    connect()
+    {
+        flight_.record(FlightEvent::resolve_begin);
+        tcp::resolver::results_type results;
+        if(context_.dns().lookup(host_, port_, results))
+            return on_resolve({}, results);
 
         // Look up the domain name
         resolver_.async_resolve(
-            host,
-            port,
+            host_,
+            port_,
             beast::bind_front_handler(
                 &AsyncSession::on_resolve,
                 shared_from_this()
@@ -90,71 +184,101 @@ class AsyncSession : public std::enable_shared_from_this<AsyncSession>
         beast::error_code ec,
         tcp::resolver::results_type results)
     {
-        if(ec)
-            return fail(ec, "resolve");
+        flight_.record(FlightEvent::resolve_end);
+        if(ec || state_->cancelled())
+            return finish(ec, "resolve");
 
-        // Set a timeout on the operation
-        stream_.expires_after(std::chrono::seconds(30));
+        context_.dns().store(host_, port_, results);
+        flight_.record(FlightEvent::connect_begin);
 
-        // Make the connection on the IP address we get from a lookup
-        stream_.async_connect(
+        // Race the addresses in the balancer's order, with a timeout
+        context_.async_connect(
             results,
+            std::chrono::seconds(30),
             beast::bind_front_handler(
                 &AsyncSession::on_connect,
                 shared_from_this()
-            )
+            ),
+            &racer_
         );
     }
 
     void
-    on_connect(beast::error_code ec, tcp::resolver::results_type::endpoint_type)
+    on_connect(beast::error_code ec, tcp::socket socket, tcp::endpoint endpoint)
     {
-        if(ec)
-            return fail(ec, "connect");
+        racer_.reset();
+        flight_.record(FlightEvent::connect_end);
+        if(ec || state_->cancelled()){
+            if(ec)
+                context_.dns().evict(host_, port_);
+            return finish(ec, "connect");
+        }
+
+        stream_ = boost::make_unique<PlainStream>(std::move(socket));
+        endpoint_ = endpoint;
+        if(warm_)
+            return park();
+
+        send();
+    }
 
+    void
+    send()
+    {
         // Set a timeout on the operation
-        stream_.expires_after(std::chrono::seconds(30));
+        stream_->expires_after(std::chrono::seconds(30));
+
+        // Measure the exchange against the address it went to. With Fast
+        // Open a new connection has no peer until the server answers its
+        // SYN, the racer's address stands in.
+        beast::error_code ec;
+        auto endpoint = stream_->socket().remote_endpoint(ec);
+        if(!ec)
+            endpoint_ = endpoint;
+        context_.balancer().begin(endpoint_);
+        sent_at_ = std::chrono::steady_clock::now();
+        measuring_ = true;
 
         if(req_type_ == "empty"){
-            // Send the HTTP request to the remote host
-            http::async_write(stream_, empty_req_,
+            // Send the HTTP request to the remote host and read the response
+            return async_exchange(*stream_, *stream_, empty_req_, buffer_, res_, context_.continue_timeout(),
                 beast::bind_front_handler(
-                    &AsyncSession::on_write,
+                    &AsyncSession::on_exchange,
                     shared_from_this()
-                )
+                ),
+                nullptr,
+                &flight_
             );
         }
 
-        if(req_type_ == "loaded"){
-            // Send the HTTP request to the remote host
-            http::async_write(stream_, loaded_req_,
-                beast::bind_front_handler(
-                    &AsyncSession::on_write,
-                    shared_from_this()
-                )
-            );
+        // Send a large body straight from its pages
+        RequestExchange<PlainStream, PlainStream, http::string_body>::Writer writer;
+        if(zerocopy_eligible(stream_->socket(), loaded_req_)){
+            auto self = shared_from_this();
+            writer = [self](std::function<void(beast::error_code, std::size_t)> handler){
+                async_write_zerocopy(*self->stream_, self->loaded_req_, self->zerocopy_, std::move(handler));
+            };
         }
-    }
 
-    void
-    on_write(
-        beast::error_code ec,
-        std::size_t bytes_transferred)
-    {
-        boost::ignore_unused(bytes_transferred);
-
-        if(ec)
-            return fail(ec, "write");
-        
-        // Receive the HTTP response
-        http::async_read(stream_, buffer_, res_,
+        // Send the HTTP request to the remote host, an early response ends the upload
+        async_exchange(*stream_, *stream_, loaded_req_, buffer_, res_, context_.continue_timeout(),
             beast::bind_front_handler(
-                &AsyncSession::on_read,
+                &AsyncSession::on_exchange,
                 shared_from_this()
-            )
+            ),
+            writer,
+            &flight_
         );
     }
 
+    void
+    on_exchange(beast::error_code ec, bool complete)
+    {
+        // A connection with part of a body sent can't carry another request
+        reusable_ = complete;
+        on_read(ec, 0);
+    }
+
     void
     on_read(
         beast::error_code ec,
@@ -162,26 +286,132 @@ class AsyncSession : public std::enable_shared_from_this<AsyncSession>
     {
         boost::ignore_unused(bytes_transferred);
 
-        if(ec)
-            return fail(ec, "read");
+        if(ec && reused_ && !state_->cancelled() && is_stale_connection(ec))
+            return retry();
+
+        if(ec || state_->cancelled())
+            return finish(ec, "read");
+
+        // The kernel may still read the body's pages until they are
+        // acknowledged, unless the connection is dropped anyway
+        if(reusable_ && !zerocopy_.done()){
+            return zerocopy_.async_wait(stream_->socket(),
+                beast::bind_front_handler(
+                    &AsyncSession::on_settled,
+                    shared_from_this()
+                )
+            );
+        }
+
+        measure(res_.result_int() < 500);
 
         //check for the error
         if(res_.result() != http::status::ok){
             std::cout << "HTTP ERROR: " << res_.result() << "\n";
             std::cout << "Status Code: " << res_.result_int() << "\n";
-            std::cout << "Response Body: " << res_.body() << "\n";
+            std::cout << "Response Body: " << res_.body().view() << "\n";
         }
 
-        //Send the message to the callback
-        callback_(res_.body());
+        // Park the connection before the callback so a request
+        // issued from it can already reuse the connection
+        auto keep_alive = res_.keep_alive() && reusable_;
+        if(keep_alive)
+            context_.pool().release(key_, std::move(stream_));
+
+        //Send the message to the callback, then recycle its buffer
+        flight_.record(FlightEvent::callback_begin);
+        callback_(res_);
+        flight_.record(FlightEvent::callback_end);
+        flight_.end(res_.result_int());
+        context_.pool().buffers().release(std::move(res_.body()));
+        state_->complete({});
+
+        // A connection that was cut short is closed already
+        if(keep_alive || !reusable_)
+            return;
 
         // Gracefully close the socket
-        stream_.socket().shutdown(tcp::socket::shutdown_both, ec);
+        stream_->socket().shutdown(tcp::socket::shutdown_both, ec);
 
         // not_connected happens sometimes so don't bother reporting it.
         if(ec && ec != beast::errc::not_connected)
             return fail(ec, "shutdown");
     }
+
+    void
+    on_settled(beast::error_code ec)
+    {
+        if(ec || state_->cancelled())
+            return finish(ec, "zerocopy");
+
+        on_read({}, 0);
+    }
+
+    // Close the connection so the pending operation completes with
+    // operation_aborted. A closed connection is never pooled again.
+    void
+    abort()
+    {
+        if(state_->done())
+            return;
+
+        resolver_.cancel();
+        if(racer_)
+            racer_->cancel();
+        if(stream_)
+            beast::get_lowest_layer(*stream_).close();
+    }
+
+    // Feed the exchange's latency and outcome to the balancer
+    void
+    measure(bool ok)
+    {
+        if(!measuring_)
+            return;
+
+        measuring_ = false;
+        if(state_->cancelled())
+            return context_.balancer().abandon(endpoint_);
+        context_.balancer().end(endpoint_, std::chrono::steady_clock::now() - sent_at_, ok);
+    }
+
+    // Report a failure unless it was caused by cancellation
+    void
+    finish(beast::error_code ec, char const* what)
+    {
+        measure(false);
+        if(state_->cancelled())
+            ec = net::error::operation_aborted;
+        else
+            fail(ec, what);
+
+        flight_.error(ec);
+        flight_.end(0);
+        state_->complete(ec);
+    }
+
+    // Hand a freshly opened connection to the pool
+    void
+    park()
+    {
+        context_.pool().release(key_, std::move(stream_));
+        state_->complete({});
+    }
+
+    void
+    retry()
+    {
+        flight_.record(FlightEvent::retry);
+        // a stale pooled connection says nothing about the address
+        if(measuring_)
+            context_.balancer().abandon(endpoint_);
+        measuring_ = false;
+        reused_ = false;
+        zerocopy_ = {};
+        buffer_.clear();
+        reset_response(res_);
+        connect();
+    }
 };
 
 #endif // ASYNC_SESSON_HPP
\ No newline at end of file
@@ -1,10 +1,14 @@
-#ifndef ASYNC_SSl_SESSON_HPP
+#ifndef ASYNC_SSL_SESSON_HPP
 #define ASYNC_SSL_SESSON_HPP
+//include build options
+#include "httpConfig.hpp"
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/beast/ssl.hpp>
 #include <boost/beast/version.hpp>
-#include <boost/asio/strand.hpp>
+//include shared loop, pool and caches
+#include "clientContext.hpp"
+#include "requestHandle.hpp"
 
 
 #include <iostream>
@@ -19,29 +23,50 @@ using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
 //------------------------------------------------------------------------------
 
 // Report a failure
-void
+inline void
 fail(beast::error_code ec, char const* what)
 {
     std::cerr << what << ": " << ec.message() << "\n";
 }
 
-// Performs an HTTP GET and prints the response
+// Performs an HTTPS request on the shared client loop, reusing
+// a pooled connection when one is idle for the host
 class AsyncSslSession : public std::enable_shared_from_this<AsyncSslSession>
 {
+    ClientContext& context_;
     tcp::resolver resolver_;
-    beast::ssl_stream<beast::tcp_stream> stream_;
+    std::unique_ptr<SslStream> stream_;
     beast::flat_buffer buffer_;
     http::request<http::empty_body> empty_req_;
     http::request<http::string_body> loaded_req_;
     std::string req_type_;
-    http::response<http::string_body> res_;
-    std::function<void(std::string)> callback_;
+    http::response<padded_body> res_;
+    ResponseHandler callback_;
+    std::string host_;
+    std::string port_;
+    std::string key_;
+    bool reused_ = false;
+    std::shared_ptr<RequestState> state_;
+    std::shared_ptr<EndpointRacer> racer_;
+    tcp::endpoint endpoint_;
+    std::chrono::steady_clock::time_point sent_at_;
+    bool measuring_ = false;
+    bool warm_ = false;
+    bool ktls_ = false;
+    bool reusable_ = true;
+    FlightTrace flight_;
 
 public:
     explicit AsyncSslSession(
-        net::executor ex,
-        ssl::context& ctx
-    ) : resolver_(ex) , stream_(ex, ctx){}
+        ClientContext& context
+    ) : context_(context), resolver_(context.io()){}
+
+    // A session dropped with its loop must not leave waiters hanging
+    ~AsyncSslSession()
+    {
+        if(state_)
+            state_->complete(net::error::operation_aborted);
+    }
 
     // Start the asynchronous operation
     void
@@ -49,20 +74,15 @@ public:
         char const* host,
         char const* port,
         const http::request<http::empty_body>& request,
-        std::function<void(std::string)> callback
+        ResponseHandler callback,
+        std::shared_ptr<RequestState> state
     ){
 
         empty_req_ = request;
         callback_ = callback;
         req_type_ = "empty";
-
-        // Look up the domain name
-        resolver_.async_resolve(host, port,
-            beast::bind_front_handler(
-                &AsyncSslSession::on_resolve,
-                shared_from_this()
-            )
-        );
+        state_ = state;
+        start(host, port);
     }
 
     void
@@ -70,15 +90,93 @@ public:
         char const* host,
         char const* port,
         const http::request<http::string_body>& request,
-        std::function<void(std::string)> callback
+        ResponseHandler callback,
+        std::shared_ptr<RequestState> state
     ){
 
         loaded_req_ = request;
         callback_ = callback;
         req_type_ = "loaded";
+        state_ = state;
+        start(host, port);
+    }
+
+    // Open a connection and park it in the pool instead of sending a
+    // request, so a later request skips the setup
+    void
+    warm(
+        char const* host,
+        char const* port,
+        std::shared_ptr<RequestState> state
+    ){
+        warm_ = true;
+        state_ = state;
+        start(host, port);
+    }
+
+    void
+    start(char const* host, char const* port)
+    {
+        host_ = host;
+        port_ = port;
+        key_ = port_ + "://" + host_;
+
+        // Cancelling the handle aborts whatever step is in flight on the loop
+        std::weak_ptr<AsyncSslSession> weak = shared_from_this();
+        state_->on_cancel([weak, &io = context_.io()]{
+            net::post(io, [weak]{
+                if(auto self = weak.lock())
+                    self->abort();
+            });
+        });
+
+        // Hop onto the loop before touching the stream
+        net::dispatch(
+            context_.io(),
+            beast::bind_front_handler(
+                &AsyncSslSession::on_start,
+                shared_from_this()
+            )
+        );
+    }
+
+    void
+    on_start()
+    {
+        if(state_->cancelled())
+            return finish({}, "start");
+
+        // A warm-up always opens a new connection
+        if(warm_)
+            return connect();
+
+        // Trace the request if the context records them
+        flight_ = FlightTrace(context_.flight_recorder(), host_);
+
+        // Read the response into a recycled buffer
+        res_.body() = context_.pool().buffers().acquire();
+
+        // Skip resolve, connect and handshake when an idle connection is pooled
+        stream_ = context_.pool().acquire<SslStream>(key_, context_.scorer());
+        reused_ = stream_ != nullptr;
+        if(reused_){
+            flight_.record(FlightEvent::pool_reuse);
+            return on_handshake({});
+        }
+
+        connect();
+    }
+
+    void
+    connect()
+    {
+        flight_.record(FlightEvent::resolve_begin);
+        tcp::resolver::results_type results;
+        if(context_.dns().lookup(host_, port_, results))
+            return on_resolve({}, results);
 
         // Look up the domain name
-        resolver_.async_resolve(host, port,
+        resolver_.async_resolve(host_, port_,
             beast::bind_front_handler(
                 &AsyncSslSession::on_resolve,
                 shared_from_this()
@@ -91,30 +189,46 @@ public:
         beast::error_code ec,
         tcp::resolver::results_type results)
     {
-        if(ec)
-            return fail(ec, "resolve");
-        
-        // Set a timeout on the operation
-        beast::get_lowest_layer(stream_).expires_after(std::chrono::seconds(30));
+        flight_.record(FlightEvent::resolve_end);
+        if(ec || state_->cancelled())
+            return finish(ec, "resolve");
+
+        context_.dns().store(host_, port_, results);
+        flight_.record(FlightEvent::connect_begin);
 
-        // Make the connection on the IP address we get from a lookup
-        beast::get_lowest_layer(stream_).async_connect(
+        // Race the addresses in the balancer's order, with a timeout
+        context_.async_connect(
             results,
+            std::chrono::seconds(30),
             beast::bind_front_handler(
                 &AsyncSslSession::on_connect,
                 shared_from_this()
-            )
+            ),
+            &racer_
         );
     }
 
     void
-    on_connect(beast::error_code ec, tcp::resolver::results_type::endpoint_type)
+    on_connect(beast::error_code ec, tcp::socket socket, tcp::endpoint)
     {
-        if(ec)
-            return fail(ec, "connect");
+        racer_.reset();
+        flight_.record(FlightEvent::connect_end);
+        if(ec || state_->cancelled()){
+            if(ec)
+                context_.dns().evict(host_, port_);
+            return finish(ec, "connect");
+        }
+
+        stream_ = boost::make_unique<SslStream>(beast::tcp_stream(std::move(socket)), context_.ssl());
+        boost::certify::set_server_hostname(*stream_, host_);
+        boost::certify::sni_hostname(*stream_, host_);
+
+        // Set a timeout on the operation
+        beast::get_lowest_layer(*stream_).expires_after(std::chrono::seconds(30));
 
         // Perform the SSL handshake
-        stream_.async_handshake(
+        flight_.record(FlightEvent::handshake_begin);
+        stream_->async_handshake(
             ssl::stream_base::client,
             beast::bind_front_handler(
                 &AsyncSslSession::on_handshake,
@@ -126,54 +240,68 @@ public:
     void
     on_handshake(beast::error_code ec)
     {
-        if(ec)
-            return fail(ec, "handshake");
+        if(!reused_)
+            flight_.record(FlightEvent::handshake_end);
+        if(ec || state_->cancelled())
+            return finish(ec, "handshake");
+
+        // Hand a fresh connection's encryption to the kernel if opted in,
+        // pooled ones keep whatever mode they were set up with
+        if(!reused_ && context_.ktls())
+            ktls_enable_tx(*stream_);
+        ktls_ = ktls_tx_active(*stream_);
+
+        if(warm_)
+            return park();
 
         // Set a timeout on the operation
-        beast::get_lowest_layer(stream_).expires_after(std::chrono::seconds(30));
+        beast::get_lowest_layer(*stream_).expires_after(std::chrono::seconds(30));
+
+        // Measure the exchange against the address it went to
+        endpoint_ = beast::get_lowest_layer(*stream_).socket().remote_endpoint(ec);
+        context_.balancer().begin(endpoint_);
+        sent_at_ = std::chrono::steady_clock::now();
+        measuring_ = true;
+
+        // With kTLS the kernel encrypts, so write to the socket directly
+        if(ktls_)
+            return send(beast::get_lowest_layer(*stream_));
+        send(*stream_);
+    }
 
+    template<class WriteStream>
+    void
+    send(WriteStream& stream)
+    {
         if(req_type_ == "empty"){
-
-            // Send the HTTP request to the remote host
-            http::async_write(stream_, empty_req_,
+            // Send the HTTP request to the remote host and read the response
+            return async_exchange(*stream_, stream, empty_req_, buffer_, res_, context_.continue_timeout(),
                 beast::bind_front_handler(
-                    &AsyncSslSession::on_write,
+                    &AsyncSslSession::on_exchange,
                     shared_from_this()
-                )
+                ),
+                nullptr,
+                &flight_
             );
-
         }
 
-        if(req_type_ == "loaded"){
-
-            // Send the HTTP request to the remote host
-            http::async_write(stream_, loaded_req_,
-                beast::bind_front_handler(
-                    &AsyncSslSession::on_write,
-                    shared_from_this()
-                )
-            );
-
-        }
+        // Send the HTTP request to the remote host, an early response ends the upload
+        async_exchange(*stream_, stream, loaded_req_, buffer_, res_, context_.continue_timeout(),
+            beast::bind_front_handler(
+                &AsyncSslSession::on_exchange,
+                shared_from_this()
+            ),
+            nullptr,
+            &flight_
+        );
     }
 
     void
-    on_write(
-        beast::error_code ec,
-        std::size_t bytes_transferred)
+    on_exchange(beast::error_code ec, bool complete)
     {
-        boost::ignore_unused(bytes_transferred);
-
-        if(ec)
-            return fail(ec, "write");
-
-        // Receive the HTTP response
-        http::async_read(stream_, buffer_, res_,
-            beast::bind_front_handler(
-                &AsyncSslSession::on_read,
-                shared_from_this()
-            )
-        );
+        // A connection with part of a body sent can't carry another request
+        reusable_ = complete;
+        on_read(ec, 0);
     }
 
     void
@@ -183,24 +311,48 @@ public:
     ){
         boost::ignore_unused(bytes_transferred);
 
-        if(ec)
-            return fail(ec, "read");
+        if(ec && reused_ && !state_->cancelled() && is_stale_connection(ec))
+            return retry();
+
+        if(ec || state_->cancelled())
+            return finish(ec, "read");
+
+        measure(res_.result_int() < 500);
 
         //check for the error
         if(res_.result() != http::status::ok){
             std::cout << "HTTP ERROR: " << res_.result() << "\n";
             std::cout << "Status Code: " << res_.result_int() << "\n";
-            std::cout << "Response Body: " << res_.body() << "\n";
+            std::cout << "Response Body: " << res_.body().view() << "\n";
         }
 
-        //Send the message to the callback
-        callback_(res_.body());
+        // Park the connection before the callback so a request
+        // issued from it can already reuse the connection
+        auto keep_alive = res_.keep_alive() && reusable_;
+        if(keep_alive)
+            context_.pool().release(key_, std::move(stream_));
+
+        //Send the message to the callback, then recycle its buffer
+        flight_.record(FlightEvent::callback_begin);
+        callback_(res_);
+        flight_.record(FlightEvent::callback_end);
+        flight_.end(res_.result_int());
+        context_.pool().buffers().release(std::move(res_.body()));
+        state_->complete({});
+
+        if(keep_alive)
+            return;
+
+        // OpenSSL can't send close_notify once the kernel owns the
+        // write side, nor after a cancelled write, just close the socket
+        if(ktls_ || !reusable_)
+            return on_shutdown({});
 
         // Set a timeout on the operation
-        beast::get_lowest_layer(stream_).expires_after(std::chrono::seconds(30));
+        beast::get_lowest_layer(*stream_).expires_after(std::chrono::seconds(30));
 
         // Gracefully close the stream
-        stream_.async_shutdown(
+        stream_->async_shutdown(
             beast::bind_front_handler(
                 &AsyncSslSession::on_shutdown,
                 shared_from_this()
@@ -224,6 +376,71 @@ public:
             return fail(ec, "shutdown");
 
     }
+
+    // Close the connection so the pending operation completes with
+    // operation_aborted. A closed connection is never pooled again.
+    void
+    abort()
+    {
+        if(state_->done())
+            return;
+
+        resolver_.cancel();
+        if(racer_)
+            racer_->cancel();
+        if(stream_)
+            beast::get_lowest_layer(*stream_).close();
+    }
+
+    // Feed the exchange's latency and outcome to the balancer
+    void
+    measure(bool ok)
+    {
+        if(!measuring_)
+            return;
+
+        measuring_ = false;
+        if(state_->cancelled())
+            return context_.balancer().abandon(endpoint_);
+        context_.balancer().end(endpoint_, std::chrono::steady_clock::now() - sent_at_, ok);
+    }
+
+    // Report a failure unless it was caused by cancellation
+    void
+    finish(beast::error_code ec, char const* what)
+    {
+        measure(false);
+        if(state_->cancelled())
+            ec = net::error::operation_aborted;
+        else
+            fail(ec, what);
+
+        flight_.error(ec);
+        flight_.end(0);
+        state_->complete(ec);
+    }
+
+    // Hand a freshly opened connection to the pool
+    void
+    park()
+    {
+        context_.pool().release(key_, std::move(stream_));
+        state_->complete({});
+    }
+
+    void
+    retry()
+    {
+        flight_.record(FlightEvent::retry);
+        // a stale pooled connection says nothing about the address
+        if(measuring_)
+            context_.balancer().abandon(endpoint_);
+        measuring_ = false;
+        reused_ = false;
+        buffer_.clear();
+        reset_response(res_);
+        connect();
+    }
 };
 
 #endif // ASYNC_SSL_SESSON_HPP
\ No newline at end of file
@@ -0,0 +1,313 @@
+#ifndef ASYNC_UNIX_SESSION_HPP
+#define ASYNC_UNIX_SESSION_HPP
+//include build options
+#include "httpConfig.hpp"
+//include beast
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+//include shared loop, pool and caches
+#include "clientContext.hpp"
+#include "requestHandle.hpp"
+//include others
+#include <iostream>
+#include <string>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using local = boost::asio::local::stream_protocol;
+
+
+// Performs an HTTP request over a unix domain socket on the shared
+// client loop, e.g. to a sidecar proxy on the same machine. The socket
+// path stands in for the host: no resolve, no address racing, and
+// idle connections are pooled per path.
+class AsyncUnixSession : public std::enable_shared_from_this<AsyncUnixSession>
+{
+    ClientContext& context_;
+    std::unique_ptr<UnixStream> stream_;
+    beast::flat_buffer buffer_;
+    http::request<http::empty_body> empty_req_;
+    http::request<http::string_body> loaded_req_;
+    std::string req_type_;
+    http::response<padded_body> res_;
+    ResponseHandler callback_;
+    std::string path_;
+    std::string key_;
+    bool reused_ = false;
+    std::shared_ptr<RequestState> state_;
+    bool warm_ = false;
+    bool reusable_ = true;
+    FlightTrace flight_;
+
+    public:
+    // All handlers run on the context's single loop thread, which
+    // serializes them the same way a strand would.
+    explicit
+    AsyncUnixSession(ClientContext& context)
+        : context_(context)
+    {
+    }
+
+    // A session dropped with its loop must not leave waiters hanging
+    ~AsyncUnixSession()
+    {
+        if(state_)
+            state_->complete(net::error::operation_aborted);
+    }
+
+    // Start the asynchronous operation
+    void
+    run(
+        char const* path,
+        const http::request<http::empty_body>& request,
+        ResponseHandler callback,
+        std::shared_ptr<RequestState> state
+    ){
+        empty_req_ = request;
+        callback_ = callback;
+        req_type_ = "empty";
+        state_ = state;
+        start(path);
+    }
+
+    void
+    run(
+        char const* path,
+        const http::request<http::string_body>& request,
+        ResponseHandler callback,
+        std::shared_ptr<RequestState> state
+    ){
+        loaded_req_ = request;
+        callback_ = callback;
+        req_type_ = "loaded";
+        state_ = state;
+        start(path);
+    }
+
+    // Open a connection and park it in the pool instead of sending a
+    // request, so a later request skips the setup
+    void
+    warm(
+        char const* path,
+        std::shared_ptr<RequestState> state
+    ){
+        warm_ = true;
+        state_ = state;
+        start(path);
+    }
+
+    void
+    start(char const* path)
+    {
+        path_ = path;
+        key_ = "unix://" + path_;
+
+        // Cancelling the handle aborts whatever step is in flight on the loop
+        std::weak_ptr<AsyncUnixSession> weak = shared_from_this();
+        state_->on_cancel([weak, &io = context_.io()]{
+            net::post(io, [weak]{
+                if(auto self = weak.lock())
+                    self->abort();
+            });
+        });
+
+        // Hop onto the loop before touching the stream
+        net::dispatch(
+            context_.io(),
+            beast::bind_front_handler(
+                &AsyncUnixSession::on_start,
+                shared_from_this()
+            )
+        );
+    }
+
+    void
+    on_start()
+    {
+        if(state_->cancelled())
+            return finish({}, "start");
+
+        // A warm-up always opens a new connection
+        if(warm_)
+            return connect();
+
+        // Trace the request if the context records them
+        flight_ = FlightTrace(context_.flight_recorder(), path_);
+
+        // Read the response into a recycled buffer
+        res_.body() = context_.pool().buffers().acquire();
+
+        // Skip connect when an idle connection is pooled
+        stream_ = context_.pool().acquire<UnixStream>(key_);
+        reused_ = stream_ != nullptr;
+        if(reused_){
+            flight_.record(FlightEvent::pool_reuse);
+            return send();
+        }
+
+        connect();
+    }
+
+    void
+    connect()
+    {
+        stream_ = boost::make_unique<UnixStream>(context_.io());
+
+        // Set a timeout on the operation
+        stream_->expires_after(std::chrono::seconds(30));
+
+        // Make the connection on the socket path
+        flight_.record(FlightEvent::connect_begin);
+        stream_->async_connect(
+            local::endpoint(path_),
+            beast::bind_front_handler(
+                &AsyncUnixSession::on_connect,
+                shared_from_this()
+            )
+        );
+    }
+
+    void
+    on_connect(beast::error_code ec)
+    {
+        flight_.record(FlightEvent::connect_end);
+        if(ec || state_->cancelled())
+            return finish(ec, "connect");
+
+        if(warm_)
+            return park();
+
+        send();
+    }
+
+    void
+    send()
+    {
+        // Set a timeout on the operation
+        stream_->expires_after(std::chrono::seconds(30));
+
+        if(req_type_ == "empty"){
+            // Send the HTTP request to the sidecar and read the response
+            return async_exchange(*stream_, *stream_, empty_req_, buffer_, res_, context_.continue_timeout(),
+                beast::bind_front_handler(
+                    &AsyncUnixSession::on_exchange,
+                    shared_from_this()
+                ),
+                nullptr,
+                &flight_
+            );
+        }
+
+        // Send the HTTP request to the sidecar, an early response ends the upload
+        async_exchange(*stream_, *stream_, loaded_req_, buffer_, res_, context_.continue_timeout(),
+            beast::bind_front_handler(
+                &AsyncUnixSession::on_exchange,
+                shared_from_this()
+            ),
+            nullptr,
+            &flight_
+        );
+    }
+
+    void
+    on_exchange(beast::error_code ec, bool complete)
+    {
+        // A connection with part of a body sent can't carry another request
+        reusable_ = complete;
+        on_read(ec, 0);
+    }
+
+    void
+    on_read(
+        beast::error_code ec,
+        std::size_t bytes_transferred)
+    {
+        boost::ignore_unused(bytes_transferred);
+
+        if(ec && reused_ && !state_->cancelled() && is_stale_connection(ec))
+            return retry();
+
+        if(ec || state_->cancelled())
+            return finish(ec, "read");
+
+        //check for the error
+        if(res_.result() != http::status::ok){
+            std::cout << "HTTP ERROR: " << res_.result() << "\n";
+            std::cout << "Status Code: " << res_.result_int() << "\n";
+            std::cout << "Response Body: " << res_.body().view() << "\n";
+        }
+
+        // Park the connection before the callback so a request
+        // issued from it can already reuse the connection
+        auto keep_alive = res_.keep_alive() && reusable_;
+        if(keep_alive)
+            context_.pool().release(key_, std::move(stream_));
+
+        //Send the message to the callback, then recycle its buffer
+        flight_.record(FlightEvent::callback_begin);
+        callback_(res_);
+        flight_.record(FlightEvent::callback_end);
+        flight_.end(res_.result_int());
+        context_.pool().buffers().release(std::move(res_.body()));
+        state_->complete({});
+
+        // A connection that was cut short is closed already
+        if(keep_alive || !reusable_)
+            return;
+
+        // Gracefully close the socket
+        stream_->socket().shutdown(local::socket::shutdown_both, ec);
+
+        // not_connected happens sometimes so don't bother reporting it.
+        if(ec && ec != beast::errc::not_connected)
+            return fail(ec, "shutdown");
+    }
+
+    // Close the connection so the pending operation completes with
+    // operation_aborted. A closed connection is never pooled again.
+    void
+    abort()
+    {
+        if(state_->done())
+            return;
+
+        if(stream_)
+            stream_->close();
+    }
+
+    // Report a failure unless it was caused by cancellation
+    void
+    finish(beast::error_code ec, char const* what)
+    {
+        if(state_->cancelled())
+            ec = net::error::operation_aborted;
+        else
+            fail(ec, what);
+
+        flight_.error(ec);
+        flight_.end(0);
+        state_->complete(ec);
+    }
+
+    // Hand a freshly opened connection to the pool
+    void
+    park()
+    {
+        context_.pool().release(key_, std::move(stream_));
+        state_->complete({});
+    }
+
+    void
+    retry()
+    {
+        flight_.record(FlightEvent::retry);
+        reused_ = false;
+        buffer_.clear();
+        reset_response(res_);
+        connect();
+    }
+};
+
+#endif // ASYNC_UNIX_SESSION_HPP
@@ -0,0 +1,322 @@
+#ifndef CLIENT_CONTEXT_HPP
+#define CLIENT_CONTEXT_HPP
+//include build options
+#include "httpConfig.hpp"
+//include asio
+#include <boost/asio.hpp>
+#include <boost/asio/ssl.hpp>
+//include certify for ssl
+#include <boost/certify/extensions.hpp>
+#include <boost/certify/https_verification.hpp>
+//include pooling and caching
+#include "connectionPool.hpp"
+#include "dnsCache.hpp"
+//include admission control
+#include "requestGovernor.hpp"
+//include address selection
+#include "endpointBalancer.hpp"
+#include "endpointRacer.hpp"
+//include socket options
+#include "socketProfile.hpp"
+//include request and response exchange
+#include "requestExchange.hpp"
+//include request logging and tracing
+#include "requestRecorder.hpp"
+#include "flightRecorder.hpp"
+//include cross thread submission
+#include "mpscQueue.hpp"
+//include kernel tls offload
+#include "kernelTls.hpp"
+//include others
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace asio = boost::asio;
+namespace ssl = asio::ssl;
+
+// Owns everything the clients share across requests: a persistent
+// io_context driven by a background thread, the TLS context, the DNS
+// cache, the connection pool, per-address load balancing stats and the
+// socket options new connections are opened with.
+// Sync calls do blocking I/O on sockets bound to this context, async
+// calls run their sessions on its loop once the governor admits them.
+// Destroying the context stops the loop and drops in-flight requests.
+class ClientContext
+{
+    std::unique_ptr<asio::io_context> io_;
+    asio::executor_work_guard<asio::io_context::executor_type> work_;
+    ssl::context ssl_;
+    DnsCache dns_;
+    ConnectionPool pool_;
+    RequestGovernor governor_;
+    EndpointBalancer balancer_;
+    MpscQueue<std::function<void()>> submissions_;
+    std::atomic<bool> draining_{false};
+    std::atomic<bool> ktls_{false};
+    std::atomic<std::chrono::milliseconds::rep> continue_timeout_{1000};
+    std::shared_ptr<RequestRecorder> recorder_;
+    std::shared_ptr<FlightRecorder> flight_recorder_;
+    std::mutex profiles_mutex_;
+    SocketProfile default_profile_;
+    std::unordered_map<std::string, SocketProfile> profiles_;
+    std::thread thread_;
+
+    // Warm connection floors per pool key, only touched on the loop
+    struct WarmFloor {
+        std::size_t min = 0;
+        std::size_t pending = 0;
+        std::function<void(std::function<void()>)> open;
+    };
+    std::unordered_map<std::string, WarmFloor> floors_;
+    std::unique_ptr<asio::steady_timer> warm_timer_;
+
+    // Replace idle connections before the pool's idle timeout drops
+    // them and open new ones up to each floor, then check again shortly
+    void
+    keep_floors()
+    {
+        if(floors_.empty())
+            return;
+
+        std::chrono::steady_clock::duration tick = std::max(std::chrono::seconds(1), pool_.idle_timeout() / 10);
+        auto max_age = pool_.idle_timeout() - 2 * tick;
+        for(auto& pair : floors_){
+            auto& floor = pair.second;
+            auto idle = pool_.refresh(pair.first, max_age);
+            while(idle + floor.pending < floor.min){
+                ++floor.pending;
+                auto key = pair.first;
+                floor.open([this, key]{
+                    auto it = floors_.find(key);
+                    if(it != floors_.end() && it->second.pending > 0)
+                        --it->second.pending;
+                });
+            }
+        }
+
+        if(!warm_timer_)
+            warm_timer_.reset(new asio::steady_timer(*io_));
+        warm_timer_->expires_after(tick);
+        warm_timer_->async_wait([this](beast::error_code ec){
+            if(!ec)
+                keep_floors();
+        });
+    }
+
+    // Run everything submitted so far on the loop thread
+    void
+    drain()
+    {
+        // reset before popping, so a submit racing with this drain
+        // either gets popped here or schedules the next drain
+        draining_.exchange(false, std::memory_order_acq_rel);
+
+        std::function<void()> work;
+        while(submissions_.pop(work)){
+            work();
+        }
+    }
+
+public:
+    // cpu pins the loop thread to that core, -1 leaves it unpinned
+    explicit
+    ClientContext(int cpu = -1)
+        : io_(new asio::io_context(1)) //only the loop thread runs it
+        , work_(asio::make_work_guard(*io_))
+        , ssl_(ssl::context::tls_client)
+        , governor_(*io_)
+    {
+        ssl_.set_verify_mode(ssl::context::verify_peer | ssl::context::verify_fail_if_no_peer_cert);
+        ssl_.set_default_verify_paths();
+        boost::certify::enable_native_https_server_verification(ssl_);
+
+        thread_ = std::thread([this]{
+            for(;;){
+                try{
+                    io_->run();
+                    return;
+                }catch(std::exception& ex){ //a throwing callback must not take the loop down
+                    std::cerr << "callback: " << ex.what() << "\n";
+                }
+            }
+        });
+
+#if defined(__linux__)
+        if(cpu >= 0){
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(thread_.native_handle(), sizeof(set), &set);
+        }
+#endif
+    }
+
+    ~ClientContext()
+    {
+        work_.reset();
+        io_->stop();
+        bool on_loop = thread_.get_id() == std::this_thread::get_id();
+        if(on_loop)
+            thread_.detach();
+        else
+            thread_.join();
+
+        // Sessions still queued on the loop are destroyed with it and
+        // report back to the governor, so stop admitting first. Pooled
+        // streams must go before the io_context they are bound to.
+        governor_.close();
+        std::function<void()> work;
+        while(submissions_.pop(work)){
+            work = nullptr;
+        }
+        warm_timer_.reset();
+        floors_.clear();
+        pool_.clear();
+
+        // The loop can't be destroyed from inside its own run()
+        if(on_loop)
+            io_.release();
+        else
+            io_.reset();
+    }
+
+    ClientContext(const ClientContext&) = delete;
+    ClientContext& operator=(const ClientContext&) = delete;
+
+    // The process wide context used by clients constructed without one
+    static std::shared_ptr<ClientContext>
+    shared()
+    {
+        static auto context = std::make_shared<ClientContext>();
+        return context;
+    }
+
+    asio::io_context& io(){ return *io_; }
+
+    // Run work on the loop thread. Submissions go through a lock-free
+    // queue and wake the loop once per batch rather than once each.
+    void
+    submit(std::function<void()> work)
+    {
+        submissions_.push(std::move(work));
+        if(!draining_.exchange(true, std::memory_order_acq_rel))
+            asio::post(*io_, [this]{ drain(); });
+    }
+
+    // Opt in to kernel TLS offload for connections handshaken from now
+    // on, call before making requests. Connections the kernel can't take
+    // over keep using OpenSSL. Returns false if the build has no kTLS.
+    bool
+    enable_ktls()
+    {
+#if defined(HTTP_CLIENT_HAS_KTLS)
+        ktls_prepare(ssl_);
+        ktls_ = true;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool ktls() const { return ktls_; }
+
+    // How long an async request with Expect: 100-continue waits for the
+    // server to answer its header before sending the body anyway
+    void continue_timeout(std::chrono::milliseconds timeout){ continue_timeout_ = timeout.count(); }
+    std::chrono::milliseconds continue_timeout() const { return std::chrono::milliseconds(continue_timeout_); }
+
+    ssl::context& ssl(){ return ssl_; }
+    DnsCache& dns(){ return dns_; }
+    ConnectionPool& pool(){ return pool_; }
+    RequestGovernor& governor(){ return governor_; }
+    EndpointBalancer& balancer(){ return balancer_; }
+
+    // Keep at least min idle connections pooled under key. open starts
+    // one new connection and calls its argument once the attempt is
+    // over; it runs on the loop thread. A floor of 0 removes the key.
+    void
+    keep_warm(const std::string& key, std::size_t min, std::function<void(std::function<void()>)> open)
+    {
+        min = std::min(min, pool_.max_idle_per_host());
+        asio::post(*io_, [this, key, min, open]{
+            if(min == 0){
+                floors_.erase(key);
+            }else{
+                auto& floor = floors_[key];
+                floor.min = min;
+                floor.open = open;
+            }
+            keep_floors();
+        });
+    }
+
+    // Socket options for new connections to every host without a
+    // profile of its own
+    void
+    socket_profile(const SocketProfile& profile)
+    {
+        std::lock_guard<std::mutex> lock(profiles_mutex_);
+        default_profile_ = profile;
+    }
+
+    // Socket options for new connections to host
+    void
+    socket_profile(const std::string& host, const SocketProfile& profile)
+    {
+        std::lock_guard<std::mutex> lock(profiles_mutex_);
+        profiles_[host] = profile;
+    }
+
+    SocketProfile
+    socket_profile(const std::string& host)
+    {
+        std::lock_guard<std::mutex> lock(profiles_mutex_);
+        auto it = profiles_.find(host);
+        return it != profiles_.end() ? it->second : default_profile_;
+    }
+
+    // Log every request made on the context from now on, nullptr stops
+    // logging. Requests are logged when issued, before admission.
+    void recorder(std::shared_ptr<RequestRecorder> recorder){ std::atomic_store(&recorder_, std::move(recorder)); }
+    std::shared_ptr<RequestRecorder> recorder() const { return std::atomic_load(&recorder_); }
+
+    // Trace the steps of every request started on the context from now
+    // on, nullptr stops tracing. One recorder can serve several contexts.
+    void flight_recorder(std::shared_ptr<FlightRecorder> recorder){ std::atomic_store(&flight_recorder_, std::move(recorder)); }
+    std::shared_ptr<FlightRecorder> flight_recorder() const { return std::atomic_load(&flight_recorder_); }
+
+    // Ranks idle pooled connections by their address' stats
+    ConnectionPool::Scorer
+    scorer()
+    {
+        return [this](const tcp::endpoint& endpoint){ return balancer_.score(endpoint); };
+    }
+
+    // Race the balancer's ordering of results on the loop, with the
+    // resolved host's socket profile. The handler runs on the loop thread.
+    void
+    async_connect(
+        const tcp::resolver::results_type& results,
+        std::chrono::steady_clock::duration timeout,
+        EndpointRacer::Handler handler,
+        std::shared_ptr<EndpointRacer>* racer = nullptr
+    ){
+        auto host = results.empty() ? std::string() : results.begin()->host_name();
+        auto race = std::make_shared<EndpointRacer>(*io_, balancer_, balancer_.options().attempt_delay, socket_profile(host));
+        if(racer)
+            *racer = race;
+        race->start(balancer_.order(results), timeout, std::move(handler));
+    }
+};
+
+#endif // CLIENT_CONTEXT_HPP
@@ -0,0 +1,249 @@
+#ifndef CONNECTION_POOL_HPP
+#define CONNECTION_POOL_HPP
+//include build options
+#include "httpConfig.hpp"
+//include beast
+#include <boost/beast/core.hpp>
+#include <boost/beast/ssl.hpp>
+#include <boost/beast/http/error.hpp>
+//include recycled response buffers
+#include "paddedBody.hpp"
+//include others
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace asio = boost::asio;
+using tcp = boost::asio::ip::tcp;
+
+using PlainStream = beast::tcp_stream;
+using SslStream = beast::ssl_stream<beast::tcp_stream>;
+using UnixStream = beast::basic_stream<asio::local::stream_protocol>;
+
+// The address a connection is to, as the balancer knows it. Unix
+// sockets have none and get the unspecified endpoint, which the
+// balancer doesn't track.
+template<class Stream>
+tcp::endpoint
+remote_endpoint(Stream& stream, beast::error_code& ec)
+{
+    return beast::get_lowest_layer(stream).socket().remote_endpoint(ec);
+}
+
+inline tcp::endpoint
+remote_endpoint(UnixStream&, beast::error_code& ec)
+{
+    ec = {};
+    return {};
+}
+
+// True for errors that mean a pooled connection was closed under us
+// before the server saw the request, so it is safe to send it again
+inline bool
+is_stale_connection(const beast::error_code& ec)
+{
+    return ec == http::error::end_of_stream
+        || ec == asio::error::eof
+        || ec == asio::error::connection_reset
+        || ec == asio::error::broken_pipe;
+}
+
+// Keeps idle keep-alive connections per "scheme://host" so the
+// next request to the same upstream skips connect and handshake.
+// Connections are handed out most recently used first, since
+// those are the least likely to have been closed by the server,
+// unless a scorer ranks them by the address they are connected to.
+class ConnectionPool
+{
+public:
+    // Lower is better
+    using Scorer = std::function<double(const tcp::endpoint&)>;
+
+private:
+    template<class Stream>
+    struct Idle {
+        std::unique_ptr<Stream> stream;
+        std::chrono::steady_clock::time_point since;
+        tcp::endpoint endpoint;
+    };
+
+    template<class Stream>
+    using Buckets = std::unordered_map<std::string, std::vector<Idle<Stream>>>;
+
+    std::mutex mutex_;
+    Buckets<PlainStream> plain_;
+    Buckets<SslStream> ssl_;
+    Buckets<UnixStream> unix_;
+    std::chrono::seconds idle_timeout_;
+    std::size_t max_idle_per_host_;
+    BufferPool buffers_;
+
+    Buckets<PlainStream>& buckets(PlainStream*){ return plain_; }
+    Buckets<SslStream>& buckets(SslStream*){ return ssl_; }
+    Buckets<UnixStream>& buckets(UnixStream*){ return unix_; }
+
+    // A parked connection must have nothing to read: readable
+    // means either the server closed it or sent something unexpected.
+    template<class Stream>
+    static bool
+    is_alive(Stream& stream)
+    {
+        auto& socket = beast::get_lowest_layer(stream).socket();
+        if(!socket.is_open())
+            return false;
+
+        beast::error_code ec;
+        char probe;
+        socket.non_blocking(true, ec);
+        socket.receive(asio::buffer(&probe, 1), socket.message_peek, ec);
+        beast::error_code ignored;
+        socket.non_blocking(false, ignored);
+
+        return ec == asio::error::would_block;
+    }
+
+    // A TLS connection can also be readable with records that carry no
+    // data, e.g. TLS 1.3 session tickets sent after the handshake of a
+    // preconnected stream. A non-blocking read lets the stream consume
+    // those, so only data or a close counts against the connection.
+    static bool
+    is_alive(SslStream& stream)
+    {
+        auto& socket = beast::get_lowest_layer(stream).socket();
+        if(!socket.is_open())
+            return false;
+
+        beast::error_code ec;
+        char probe;
+        socket.non_blocking(true, ec);
+        stream.read_some(asio::buffer(&probe, 1), ec);
+        beast::error_code ignored;
+        socket.non_blocking(false, ignored);
+
+        return ec == asio::error::would_block;
+    }
+
+    template<class Stream>
+    std::size_t
+    prune(
+        Buckets<Stream>& buckets,
+        const std::string& key,
+        std::chrono::steady_clock::duration max_age
+    ){
+        auto it = buckets.find(key);
+        if(it == buckets.end())
+            return 0;
+
+        auto& idle = it->second;
+        auto now = std::chrono::steady_clock::now();
+        for(std::size_t i = idle.size(); i-- > 0;){
+            if(now - idle[i].since >= max_age ||
+                !is_alive(*idle[i].stream))
+                idle.erase(idle.begin() + i);
+        }
+        return idle.size();
+    }
+
+public:
+    explicit
+    ConnectionPool(
+        std::chrono::seconds idle_timeout = std::chrono::seconds(30),
+        std::size_t max_idle_per_host = 16
+    ) : idle_timeout_(idle_timeout), max_idle_per_host_(max_idle_per_host)
+    {
+    }
+
+    // Take an idle connection for key, or nullptr if there is none
+    template<class Stream>
+    std::unique_ptr<Stream>
+    acquire(const std::string& key, const Scorer& scorer = nullptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto& buckets = this->buckets(static_cast<Stream*>(nullptr));
+        auto it = buckets.find(key);
+        if(it == buckets.end())
+            return nullptr;
+
+        auto& idle = it->second;
+        auto now = std::chrono::steady_clock::now();
+        while(!idle.empty()){
+            // most recent, or the best scored address with recency breaking ties
+            auto pick = idle.size() - 1;
+            if(scorer){
+                auto best = scorer(idle[pick].endpoint);
+                for(std::size_t i = pick; i-- > 0;){
+                    auto score = scorer(idle[i].endpoint);
+                    if(score < best){
+                        best = score;
+                        pick = i;
+                    }
+                }
+            }
+
+            auto entry = std::move(idle[pick]);
+            idle.erase(idle.begin() + pick);
+
+            if(now - entry.since < idle_timeout_ &&
+                is_alive(*entry.stream))
+                return std::move(entry.stream);
+        }
+        return nullptr;
+    }
+
+    // Park a connection after a completed keep-alive exchange
+    template<class Stream>
+    void
+    release(const std::string& key, std::unique_ptr<Stream> stream)
+    {
+        // the stream timer would otherwise close the parked socket
+        beast::get_lowest_layer(*stream).expires_never();
+
+        beast::error_code ec;
+        auto endpoint = remote_endpoint(*stream, ec);
+        if(ec)
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto& idle = buckets(static_cast<Stream*>(nullptr))[key];
+        if(idle.size() >= max_idle_per_host_)
+            return;
+
+        idle.push_back(Idle<Stream>{std::move(stream), std::chrono::steady_clock::now(), endpoint});
+    }
+
+    // Close idle connections for key parked for max_age or longer and
+    // return how many are left, so they can be replaced before the
+    // idle timeout drops them
+    std::size_t
+    refresh(const std::string& key, std::chrono::steady_clock::duration max_age)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return prune(plain_, key, max_age) + prune(ssl_, key, max_age) + prune(unix_, key, max_age);
+    }
+
+    std::chrono::seconds idle_timeout() const { return idle_timeout_; }
+    std::size_t max_idle_per_host() const { return max_idle_per_host_; }
+
+    // Response buffers, recycled between the exchanges on these connections
+    BufferPool& buffers(){ return buffers_; }
+
+    void
+    clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        plain_.clear();
+        ssl_.clear();
+        unix_.clear();
+        buffers_.clear();
+    }
+};
+
+#endif // CONNECTION_POOL_HPP
@@ -0,0 +1,91 @@
+#ifndef DNS_CACHE_HPP
+#define DNS_CACHE_HPP
+//include build options
+#include "httpConfig.hpp"
+//include asio
+#include <boost/asio.hpp>
+//include others
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace asio = boost::asio;
+using tcp = boost::asio::ip::tcp;
+
+// Caches resolver results per host and service so repeated
+// requests to the same upstream skip the getaddrinfo round trip.
+// Shared by the sync and async clients, hence the mutex.
+class DnsCache
+{
+    struct Entry {
+        tcp::resolver::results_type results;
+        std::chrono::steady_clock::time_point expires;
+    };
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::chrono::seconds ttl_;
+
+    static std::string
+    key(const std::string& host, const std::string& port)
+    {
+        return host + ":" + port;
+    }
+
+public:
+    explicit
+    DnsCache(std::chrono::seconds ttl = std::chrono::seconds(60))
+        : ttl_(ttl)
+    {
+    }
+
+    // Fills results and returns true if a fresh entry exists
+    bool
+    lookup(
+        const std::string& host,
+        const std::string& port,
+        tcp::resolver::results_type& results
+    ){
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto it = entries_.find(key(host, port));
+        if(it == entries_.end())
+            return false;
+
+        if(it->second.expires <= std::chrono::steady_clock::now()){
+            entries_.erase(it);
+            return false;
+        }
+
+        results = it->second.results;
+        return true;
+    }
+
+    void
+    store(
+        const std::string& host,
+        const std::string& port,
+        const tcp::resolver::results_type& results
+    ){
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_[key(host, port)] = Entry{results, std::chrono::steady_clock::now() + ttl_};
+    }
+
+    // Drop an entry, e.g. after none of its addresses accepted a connection
+    void
+    evict(const std::string& host, const std::string& port)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.erase(key(host, port));
+    }
+
+    void
+    clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+    }
+};
+
+#endif // DNS_CACHE_HPP
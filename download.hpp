@@ -0,0 +1,130 @@
+#ifndef DOWNLOAD_HPP
+#define DOWNLOAD_HPP
+//include build options
+#include "httpConfig.hpp"
+//include beast
+#include <boost/beast/core/error.hpp>
+//include posix file io
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+//include others
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <string>
+
+namespace beast = boost::beast;
+
+struct DownloadOptions {
+    // ranges fetched at once, each over its own pooled connection
+    std::size_t connections = 4;
+    // largest range a single request asks for; smaller ranges spread
+    // better across connections and lose less on a failure
+    std::uint64_t chunk_size = 16 * 1024 * 1024;
+    // failed requests per range before the download gives up, a range
+    // resumes from the last byte it received
+    unsigned retries = 3;
+    // called with the bytes received so far and the total, 0 if the
+    // server didn't say; runs on the worker threads, one call at a time
+    std::function<void(std::uint64_t received, std::uint64_t total)> progress;
+};
+
+// Bytes [offset, end) of the output still to fetch. offset advances as
+// data arrives, so a retry asks only for what is missing.
+struct ByteRange {
+    static constexpr std::uint64_t npos = std::numeric_limits<std::uint64_t>::max();
+
+    std::uint64_t offset = 0;
+    std::uint64_t end = npos;   // npos until the server's end of body
+    unsigned failures = 0;
+
+    bool bounded() const { return end != npos; }
+    std::uint64_t left() const { return end - offset; }
+};
+
+// Output file for a download. With a known size the file is created at
+// that size and mapped, so ranges are read straight into their region of
+// the mapping; otherwise data is appended with pwrite.
+class MappedFile
+{
+    int fd_ = -1;
+    char* data_ = nullptr;
+    std::uint64_t size_ = 0;
+
+    static beast::error_code
+    last_error()
+    {
+        return beast::error_code(errno, boost::system::system_category());
+    }
+
+public:
+    MappedFile(const std::string& path, std::uint64_t size)
+    {
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if(fd_ < 0)
+            throw beast::system_error{last_error(), path};
+
+        if(size == ByteRange::npos || size == 0)
+            return;
+
+        if(::ftruncate(fd_, static_cast<off_t>(size)) != 0){
+            auto ec = last_error();
+            ::close(fd_);
+            throw beast::system_error{ec, path};
+        }
+
+        auto data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if(data == MAP_FAILED){
+            auto ec = last_error();
+            ::close(fd_);
+            throw beast::system_error{ec, path};
+        }
+        data_ = static_cast<char*>(data);
+        size_ = size;
+    }
+
+    ~MappedFile()
+    {
+        if(data_)
+            ::munmap(data_, size_);
+        if(fd_ >= 0)
+            ::close(fd_);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Start of the mapping, null when the file isn't mapped
+    char* data() const { return data_; }
+    std::uint64_t size() const { return size_; }
+
+    // Store bytes that already sit in memory, e.g. body bytes read
+    // together with the response header
+    beast::error_code
+    write(const char* data, std::size_t size, std::uint64_t offset)
+    {
+        if(data_){
+            std::memcpy(data_ + offset, data, size);
+            return {};
+        }
+
+        while(size > 0){
+            auto written = ::pwrite(fd_, data, size, static_cast<off_t>(offset));
+            if(written < 0){
+                if(errno == EINTR)
+                    continue;
+                return last_error();
+            }
+            data += written;
+            size -= static_cast<std::size_t>(written);
+            offset += static_cast<std::uint64_t>(written);
+        }
+        return {};
+    }
+};
+
+#endif // DOWNLOAD_HPP
@@ -0,0 +1,254 @@
+#ifndef ENDPOINT_BALANCER_HPP
+#define ENDPOINT_BALANCER_HPP
+//include build options
+#include "httpConfig.hpp"
+//include asio
+#include <boost/asio.hpp>
+//include others
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace asio = boost::asio;
+using tcp = boost::asio::ip::tcp;
+
+// How the first address to connect to is picked among a host's addresses
+enum class BalancePolicy {
+    power_of_two,       // best of two random picks by latency times load
+    least_outstanding   // fewest requests in flight, latency breaks ties
+};
+
+struct BalancerOptions {
+    BalancePolicy policy = BalancePolicy::power_of_two;
+    double ewma_weight = 0.3;                   // weight of the newest latency sample
+    unsigned eject_after = 5;                   // consecutive failures before ejection
+    std::chrono::seconds base_ejection = std::chrono::seconds(30);
+    std::chrono::seconds max_ejection = std::chrono::seconds(300);
+    std::chrono::milliseconds attempt_delay = std::chrono::milliseconds(250);  // Happy Eyeballs
+};
+
+struct EndpointStats {
+    double latency_ms = 0;          // EWMA, 0 until the first sample
+    std::size_t outstanding = 0;
+    std::uint64_t successes = 0;
+    std::uint64_t failures = 0;
+    unsigned consecutive_failures = 0;
+    unsigned ejections = 0;
+    bool ejected = false;
+};
+
+// Tracks latency, load and errors per remote address and uses them to
+// order a host's resolved addresses. Addresses that keep failing are
+// ejected for a growing period; if every address is ejected they are
+// all used anyway rather than failing the request outright.
+class EndpointBalancer
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        EndpointStats stats;
+        Clock::time_point ejected_until;
+    };
+
+    std::mutex mutex_;
+    BalancerOptions options_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::minstd_rand random_{std::random_device{}()};
+
+    static std::string
+    key(const tcp::endpoint& endpoint)
+    {
+        return endpoint.address().to_string() + "|" + std::to_string(endpoint.port());
+    }
+
+    bool
+    ejected(const Entry& entry, Clock::time_point now) const
+    {
+        return entry.stats.ejections && entry.ejected_until > now;
+    }
+
+    // Connections without an address, e.g. over unix sockets
+    static bool
+    untracked(const tcp::endpoint& endpoint)
+    {
+        return endpoint == tcp::endpoint();
+    }
+
+    double
+    cost(const Entry& entry) const
+    {
+        auto load = static_cast<double>(entry.stats.outstanding);
+        if(options_.policy == BalancePolicy::least_outstanding)
+            return load + entry.stats.latency_ms / 1e6;
+        return entry.stats.latency_ms * (load + 1);
+    }
+
+    void
+    fail(Entry& entry)
+    {
+        ++entry.stats.failures;
+        if(++entry.stats.consecutive_failures < options_.eject_after)
+            return;
+
+        // back off longer each time the address is ejected again
+        auto period = options_.base_ejection * (1u << std::min(entry.stats.ejections, 8u));
+        entry.ejected_until = Clock::now() + std::min<std::chrono::seconds>(period, options_.max_ejection);
+        entry.stats.consecutive_failures = 0;
+        ++entry.stats.ejections;
+    }
+
+public:
+    void
+    options(const BalancerOptions& options)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        options_ = options;
+    }
+
+    BalancerOptions
+    options()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return options_;
+    }
+
+    EndpointStats
+    stats(const tcp::endpoint& endpoint)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& entry = entries_[key(endpoint)];
+        auto stats = entry.stats;
+        stats.ejected = ejected(entry, Clock::now());
+        return stats;
+    }
+
+    // Lower is better, used to pick among idle pooled connections
+    double
+    score(const tcp::endpoint& endpoint)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return cost(entries_[key(endpoint)]);
+    }
+
+    // Connection order for a host: the policy's pick first, then the
+    // rest by cost with address families interleaved for Happy Eyeballs
+    std::vector<tcp::endpoint>
+    order(const tcp::resolver::results_type& results)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto now = Clock::now();
+
+        std::vector<std::pair<double, tcp::endpoint>> healthy;
+        std::vector<std::pair<double, tcp::endpoint>> all;
+        for(auto& result : results){
+            auto& entry = entries_[key(result.endpoint())];
+            all.emplace_back(cost(entry), result.endpoint());
+            if(!ejected(entry, now))
+                healthy.emplace_back(all.back());
+        }
+        auto& candidates = healthy.empty() ? all : healthy;
+
+        std::vector<tcp::endpoint> ordered;
+        if(candidates.empty())
+            return ordered;
+
+        // the first choice
+        std::size_t first = 0;
+        if(options_.policy == BalancePolicy::power_of_two && candidates.size() > 1){
+            // two distinct picks
+            auto a = std::uniform_int_distribution<std::size_t>(0, candidates.size() - 1)(random_);
+            auto b = std::uniform_int_distribution<std::size_t>(0, candidates.size() - 2)(random_);
+            if(b >= a)
+                ++b;
+            first = candidates[a].first <= candidates[b].first ? a : b;
+        }else{
+            for(std::size_t i = 1; i < candidates.size(); ++i){
+                if(candidates[i].first < candidates[first].first)
+                    first = i;
+            }
+        }
+        ordered.push_back(candidates[first].second);
+        candidates.erase(candidates.begin() + first);
+
+        // the fallbacks, cheapest first, alternating families starting
+        // with the one the first choice didn't use
+        std::stable_sort(candidates.begin(), candidates.end(),
+            [](const std::pair<double, tcp::endpoint>& a, const std::pair<double, tcp::endpoint>& b){
+                return a.first < b.first;
+            });
+        std::vector<tcp::endpoint> v4, v6;
+        for(auto& candidate : candidates){
+            (candidate.second.address().is_v4() ? v4 : v6).push_back(candidate.second);
+        }
+        bool v6_next = ordered.front().address().is_v4();
+        std::size_t i4 = 0, i6 = 0;
+        while(i4 < v4.size() || i6 < v6.size()){
+            if((v6_next && i6 < v6.size()) || i4 == v4.size())
+                ordered.push_back(v6[i6++]);
+            else
+                ordered.push_back(v4[i4++]);
+            v6_next = !v6_next;
+        }
+        return ordered;
+    }
+
+    // A request started on a connection to endpoint
+    void
+    begin(const tcp::endpoint& endpoint)
+    {
+        if(untracked(endpoint))
+            return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++entries_[key(endpoint)].stats.outstanding;
+    }
+
+    // A request on endpoint finished. Failures count towards ejection.
+    void
+    end(const tcp::endpoint& endpoint, Clock::duration latency, bool ok)
+    {
+        if(untracked(endpoint))
+            return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& entry = entries_[key(endpoint)];
+        if(entry.stats.outstanding)
+            --entry.stats.outstanding;
+
+        if(!ok)
+            return fail(entry);
+
+        double sample = std::chrono::duration<double, std::milli>(latency).count();
+        entry.stats.latency_ms = entry.stats.latency_ms == 0 ? sample
+            : options_.ewma_weight * sample + (1 - options_.ewma_weight) * entry.stats.latency_ms;
+        ++entry.stats.successes;
+        entry.stats.consecutive_failures = 0;
+    }
+
+    // A request on endpoint stopped for reasons that aren't the
+    // endpoint's fault, e.g. cancellation or a stale pooled connection
+    void
+    abandon(const tcp::endpoint& endpoint)
+    {
+        if(untracked(endpoint))
+            return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& entry = entries_[key(endpoint)];
+        if(entry.stats.outstanding)
+            --entry.stats.outstanding;
+    }
+
+    void
+    connect_failed(const tcp::endpoint& endpoint)
+    {
+        if(untracked(endpoint))
+            return;
+        std::lock_guard<std::mutex> lock(mutex_);
+        fail(entries_[key(endpoint)]);
+    }
+};
+
+#endif // ENDPOINT_BALANCER_HPP
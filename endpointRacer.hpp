@@ -0,0 +1,171 @@
+#ifndef ENDPOINT_RACER_HPP
+#define ENDPOINT_RACER_HPP
+//include build options
+#include "httpConfig.hpp"
+//include asio
+#include <boost/asio.hpp>
+//include beast
+#include <boost/beast/core/error.hpp>
+//include endpoint stats
+#include "endpointBalancer.hpp"
+//include socket options
+#include "socketProfile.hpp"
+//include others
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+using tcp = boost::asio::ip::tcp;
+
+// Connects to the first of several addresses that answers, Happy
+// Eyeballs style (RFC 8305): attempts start in the given order, each
+// one attempt_delay after the previous or as soon as it fails, and the
+// first to connect wins while the others are closed. Every attempt's
+// socket gets the profile's options before it connects. Must be driven
+// from the loop thread of the io_context it was created on.
+class EndpointRacer : public std::enable_shared_from_this<EndpointRacer>
+{
+public:
+    using Handler = std::function<void(beast::error_code, tcp::socket, tcp::endpoint)>;
+
+private:
+    struct Attempt {
+        tcp::socket socket;
+        tcp::endpoint endpoint;
+        explicit Attempt(asio::io_context& io, tcp::endpoint ep) : socket(io), endpoint(ep){}
+    };
+
+    asio::io_context& io_;
+    EndpointBalancer& balancer_;
+    std::chrono::milliseconds attempt_delay_;
+    SocketProfile profile_;
+    asio::steady_timer delay_;
+    asio::steady_timer deadline_;
+    std::vector<tcp::endpoint> endpoints_;
+    std::vector<std::unique_ptr<Attempt>> attempts_;
+    std::size_t pending_ = 0;
+    std::size_t delay_generation_ = 0;      // a delay that already fired can't be cancelled, only outdated
+    bool finished_ = false;
+    beast::error_code last_error_ = asio::error::host_not_found;
+    Handler handler_;
+
+    void
+    launch()
+    {
+        if(finished_ || attempts_.size() == endpoints_.size())
+            return;
+
+        auto index = attempts_.size();
+        attempts_.push_back(std::unique_ptr<Attempt>(new Attempt(io_, endpoints_[index])));
+        ++pending_;
+
+        // options like Fast Open must be set before the connect
+        auto& socket = attempts_[index]->socket;
+        beast::error_code ec;
+        socket.open(endpoints_[index].protocol(), ec);
+        if(!ec)
+            apply_socket_profile(socket, profile_);
+
+        auto self = shared_from_this();
+        socket.async_connect(endpoints_[index], [self, index](beast::error_code ec){
+            self->on_attempt(index, ec);
+        });
+
+        // give this attempt a head start before racing the next address
+        if(attempts_.size() < endpoints_.size()){
+            auto generation = ++delay_generation_;
+            delay_.expires_after(attempt_delay_);
+            delay_.async_wait([self, generation](beast::error_code ec){
+                if(!ec && generation == self->delay_generation_)
+                    self->launch();
+            });
+        }
+    }
+
+    void
+    on_attempt(std::size_t index, beast::error_code ec)
+    {
+        --pending_;
+        if(finished_)
+            return;
+
+        auto& attempt = *attempts_[index];
+        if(!ec){
+            auto socket = std::move(attempt.socket);
+            return finish({}, std::move(socket), attempt.endpoint);
+        }
+
+        balancer_.connect_failed(attempt.endpoint);
+        last_error_ = ec;
+
+        // a failed attempt doesn't wait out the delay
+        if(attempts_.size() < endpoints_.size()){
+            ++delay_generation_;
+            delay_.cancel();
+            return launch();
+        }
+        if(pending_ == 0)
+            finish(last_error_, tcp::socket(io_), {});
+    }
+
+    void
+    finish(beast::error_code ec, tcp::socket socket, tcp::endpoint endpoint)
+    {
+        finished_ = true;
+        delay_.cancel();
+        deadline_.cancel();
+        for(auto& attempt : attempts_){
+            beast::error_code ignored;
+            attempt->socket.close(ignored);
+        }
+        auto handler = std::move(handler_);
+        handler(ec, std::move(socket), endpoint);
+    }
+
+public:
+    EndpointRacer(
+        asio::io_context& io,
+        EndpointBalancer& balancer,
+        std::chrono::milliseconds attempt_delay,
+        SocketProfile profile = {}
+    ) : io_(io)
+      , balancer_(balancer)
+      , attempt_delay_(attempt_delay)
+      , profile_(profile)
+      , delay_(io)
+      , deadline_(io)
+    {
+    }
+
+    void
+    start(std::vector<tcp::endpoint> endpoints, std::chrono::steady_clock::duration timeout, Handler handler)
+    {
+        endpoints_ = std::move(endpoints);
+        handler_ = std::move(handler);
+
+        if(endpoints_.empty())
+            return finish(last_error_, tcp::socket(io_), {});
+
+        auto self = shared_from_this();
+        deadline_.expires_after(timeout);
+        deadline_.async_wait([self](beast::error_code ec){
+            if(!ec && !self->finished_)
+                self->finish(asio::error::timed_out, tcp::socket(self->io_), {});
+        });
+
+        launch();
+    }
+
+    // Abort every attempt, the handler gets operation_aborted
+    void
+    cancel()
+    {
+        if(!finished_)
+            finish(asio::error::operation_aborted, tcp::socket(io_), {});
+    }
+};
+
+#endif // ENDPOINT_RACER_HPP
@@ -0,0 +1,389 @@
+#ifndef FLIGHT_RECORDER_HPP
+#define FLIGHT_RECORDER_HPP
+//include build options
+#include "httpConfig.hpp"
+//include beast
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/core/string.hpp>
+//include others
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace beast = boost::beast;
+
+// What happened to a request, in the order it usually happens. Spans are
+// recorded as a begin and an end event.
+enum class FlightEvent : std::uint8_t
+{
+    request_begin,      // arg: the host, interned by the thread's ring
+    request_end,        // arg: the response status, 0 if it failed
+    resolve_begin,
+    resolve_end,
+    connect_begin,
+    connect_end,
+    handshake_begin,
+    handshake_end,
+    first_byte,         // the final response's header is in
+    last_byte,          // arg: the response status
+    callback_begin,
+    callback_end,
+    pool_reuse,         // an idle pooled connection was taken
+    retry,              // the pooled connection was stale, reconnecting
+    error               // arg: the error code's value
+};
+
+// Keeps the last events of every request, per thread, so a slow request
+// can be taken apart after the fact: DNS, connect, TLS, the server or the
+// callback. Each thread that records gets a fixed size ring it writes
+// without locks or allocations; the oldest events are overwritten. A
+// dump, which may run while requests are recorded, writes what the rings
+// hold as Chrome trace events (chrome://tracing, ui.perfetto.dev), one
+// async track per request.
+class FlightRecorder
+{
+    struct Slot {
+        std::atomic<std::int64_t> time{0};      // steady clock, nanoseconds
+        std::atomic<std::uint64_t> id{0};
+        std::atomic<std::uint64_t> data{0};     // event, arg << 32
+    };
+
+    // Written by one thread only. begin_ moves before a slot is written,
+    // end_ after, so a dump can tell the slots overwritten under it.
+    struct Ring {
+        std::unique_ptr<Slot[]> slots;
+        std::uint64_t mask;
+        std::atomic<std::uint64_t> begin_{0};
+        std::atomic<std::uint64_t> end_{0};
+        std::thread::id owner;
+        std::uint32_t thread;
+        std::vector<std::string> hosts;         // appended under mutex_
+
+        Ring(std::size_t capacity, std::thread::id owner, std::uint32_t thread)
+            : slots(new Slot[capacity]), mask(capacity - 1), owner(owner), thread(thread)
+        {
+        }
+    };
+
+    static constexpr std::size_t max_hosts = 1024;
+
+    std::size_t capacity_;
+    std::uint64_t serial_;
+    std::atomic<std::uint64_t> next_id_{1};
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+
+    static std::uint64_t
+    next_serial()
+    {
+        static std::atomic<std::uint64_t> serial{1};
+        return serial.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The calling thread's ring, found once and then cached per thread
+    Ring&
+    ring()
+    {
+        struct Cache {
+            std::uint64_t serial = 0;
+            Ring* ring = nullptr;
+        };
+        thread_local Cache cache;
+        if(cache.serial == serial_)
+            return *cache.ring;
+
+        auto self = std::this_thread::get_id();
+        std::lock_guard<std::mutex> lock(mutex_);
+        Ring* found = nullptr;
+        for(auto& ring : rings_)
+            if(ring->owner == self)
+                found = ring.get();
+        if(!found){
+            rings_.push_back(std::unique_ptr<Ring>(new Ring(capacity_, self, static_cast<std::uint32_t>(rings_.size()))));
+            found = rings_.back().get();
+        }
+        cache = {serial_, found};
+        return *found;
+    }
+
+    std::uint32_t
+    intern(Ring& ring, beast::string_view host)
+    {
+        // only this thread appends, so it can look without the lock
+        for(std::size_t i = 0; i < ring.hosts.size(); ++i)
+            if(ring.hosts[i] == host)
+                return static_cast<std::uint32_t>(i);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(ring.hosts.size() == max_hosts)
+            return max_hosts - 1;
+        ring.hosts.emplace_back(host);
+        return static_cast<std::uint32_t>(ring.hosts.size() - 1);
+    }
+
+    static void
+    write(Ring& ring, std::uint64_t id, FlightEvent event, std::uint32_t arg)
+    {
+        auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+
+        auto index = ring.end_.load(std::memory_order_relaxed);
+        ring.begin_.store(index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        auto& slot = ring.slots[index & ring.mask];
+        slot.time.store(time, std::memory_order_relaxed);
+        slot.id.store(id, std::memory_order_relaxed);
+        slot.data.store(static_cast<std::uint64_t>(event) | static_cast<std::uint64_t>(arg) << 32, std::memory_order_relaxed);
+        ring.end_.store(index + 1, std::memory_order_release);
+    }
+
+    struct Entry {
+        std::int64_t time;
+        std::uint64_t id;
+        FlightEvent event;
+        std::uint32_t arg;
+    };
+
+    // The events a ring holds that weren't overwritten while copying them
+    static std::vector<Entry>
+    snapshot(const Ring& ring)
+    {
+        auto capacity = ring.mask + 1;
+        auto end = ring.end_.load(std::memory_order_acquire);
+        auto first = end > capacity ? end - capacity : 0;
+
+        std::vector<Entry> entries;
+        entries.reserve(end - first);
+        for(auto i = first; i < end; ++i){
+            auto& slot = ring.slots[i & ring.mask];
+            auto data = slot.data.load(std::memory_order_relaxed);
+            entries.push_back({
+                slot.time.load(std::memory_order_relaxed),
+                slot.id.load(std::memory_order_relaxed),
+                static_cast<FlightEvent>(data & 0xff),
+                static_cast<std::uint32_t>(data >> 32)
+            });
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        auto begun = ring.begin_.load(std::memory_order_relaxed);
+        auto valid = begun > capacity ? begun - capacity : 0;
+        if(valid > first)
+            entries.erase(entries.begin(), entries.begin() + std::min<std::size_t>(valid - first, entries.size()));
+        return entries;
+    }
+
+    static void
+    escape(std::string& out, beast::string_view text)
+    {
+        out += '"';
+        for(unsigned char c : text){
+            if(c == '"' || c == '\\'){
+                out += '\\';
+                out += static_cast<char>(c);
+            }else if(c < 0x20){
+                char code[7];
+                std::snprintf(code, sizeof(code), "\\u%04x", c);
+                out += code;
+            }else{
+                out += static_cast<char>(c);
+            }
+        }
+        out += '"';
+    }
+
+    // Trace event name and phase: b and e open and close a span on the
+    // request's track, n marks an instant on it
+    static std::pair<const char*, char>
+    describe(FlightEvent event)
+    {
+        switch(event){
+        case FlightEvent::request_begin:   return {"request", 'b'};
+        case FlightEvent::request_end:     return {"request", 'e'};
+        case FlightEvent::resolve_begin:   return {"resolve", 'b'};
+        case FlightEvent::resolve_end:     return {"resolve", 'e'};
+        case FlightEvent::connect_begin:   return {"connect", 'b'};
+        case FlightEvent::connect_end:     return {"connect", 'e'};
+        case FlightEvent::handshake_begin: return {"handshake", 'b'};
+        case FlightEvent::handshake_end:   return {"handshake", 'e'};
+        case FlightEvent::first_byte:      return {"response", 'b'};
+        case FlightEvent::last_byte:       return {"response", 'e'};
+        case FlightEvent::callback_begin:  return {"callback", 'b'};
+        case FlightEvent::callback_end:    return {"callback", 'e'};
+        case FlightEvent::pool_reuse:      return {"pool reuse", 'n'};
+        case FlightEvent::retry:           return {"retry", 'n'};
+        case FlightEvent::error:           return {"error", 'n'};
+        }
+        return {"unknown", 'n'};
+    }
+
+public:
+    // Keeps the last events_per_thread events of every recording thread,
+    // rounded up to a power of two. An event takes 24 bytes.
+    explicit
+    FlightRecorder(std::size_t events_per_thread = 4096)
+        : capacity_(1)
+        , serial_(next_serial())
+    {
+        while(capacity_ < events_per_thread)
+            capacity_ <<= 1;
+    }
+
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    // Start tracing a request to host, returns its id
+    std::uint64_t
+    begin(beast::string_view host)
+    {
+        auto id = next_id_.fetch_add(1, std::memory_order_relaxed);
+        auto& ring = this->ring();
+        write(ring, id, FlightEvent::request_begin, intern(ring, host));
+        return id;
+    }
+
+    void
+    record(std::uint64_t id, FlightEvent event, std::uint32_t arg = 0)
+    {
+        write(ring(), id, event, arg);
+    }
+
+    // Write what the rings hold as a Chrome trace, timestamps are in
+    // microseconds on the steady clock
+    void
+    dump(std::ostream& out) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::string event;
+        out << "{\"traceEvents\":[";
+        bool first = true;
+        for(auto& ring : rings_){
+            for(auto& entry : snapshot(*ring)){
+                auto description = describe(entry.event);
+                char head[160];
+                std::snprintf(head, sizeof(head),
+                    "{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"%c\",\"id\":%llu,\"ts\":%lld.%03lld,\"pid\":1,\"tid\":%u",
+                    description.first, description.second, static_cast<unsigned long long>(entry.id),
+                    static_cast<long long>(entry.time / 1000), static_cast<long long>(entry.time % 1000), ring->thread);
+
+                event = first ? "" : ",";
+                event += head;
+                switch(entry.event){
+                case FlightEvent::request_begin:
+                    event += ",\"args\":{\"host\":";
+                    escape(event, entry.arg < ring->hosts.size() ? beast::string_view(ring->hosts[entry.arg]) : beast::string_view());
+                    event += "}";
+                    break;
+                case FlightEvent::request_end:
+                case FlightEvent::last_byte:
+                    event += ",\"args\":{\"status\":" + std::to_string(entry.arg) + "}";
+                    break;
+                case FlightEvent::error:
+                    event += ",\"args\":{\"code\":" + std::to_string(static_cast<std::int32_t>(entry.arg)) + "}";
+                    break;
+                default:
+                    break;
+                }
+                event += "}\n";
+                out << event;
+                first = false;
+            }
+        }
+        out << "],\"displayTimeUnit\":\"ms\"}\n";
+    }
+
+    std::string
+    dump() const
+    {
+        std::ostringstream out;
+        dump(out);
+        return out.str();
+    }
+
+    // Write the trace to path, replacing it
+    void
+    dump(const std::string& path) const
+    {
+        std::ofstream out(path, std::ios::trunc);
+        if(!out)
+            throw beast::system_error{beast::error_code(errno, boost::system::system_category()), path};
+        dump(out);
+    }
+};
+
+// One request's events, a no-op without a recorder. The request ends
+// when the trace is destroyed at the latest, as a failure unless end()
+// was called with its status.
+class FlightTrace
+{
+    std::shared_ptr<FlightRecorder> recorder_;
+    std::uint64_t id_ = 0;
+
+public:
+    FlightTrace() = default;
+
+    FlightTrace(std::shared_ptr<FlightRecorder> recorder, beast::string_view host)
+        : recorder_(std::move(recorder))
+    {
+        if(recorder_)
+            id_ = recorder_->begin(host);
+    }
+
+    FlightTrace(FlightTrace&& other) noexcept
+        : recorder_(std::move(other.recorder_))
+        , id_(other.id_)
+    {
+    }
+
+    FlightTrace&
+    operator=(FlightTrace&& other) noexcept
+    {
+        end(0);
+        recorder_ = std::move(other.recorder_);
+        id_ = other.id_;
+        return *this;
+    }
+
+    ~FlightTrace()
+    {
+        end(0);
+    }
+
+    explicit operator bool() const { return recorder_ != nullptr; }
+
+    void
+    record(FlightEvent event, std::uint32_t arg = 0) const
+    {
+        if(recorder_)
+            recorder_->record(id_, event, arg);
+    }
+
+    void
+    error(const beast::error_code& ec) const
+    {
+        record(FlightEvent::error, static_cast<std::uint32_t>(ec.value()));
+    }
+
+    void
+    end(unsigned status)
+    {
+        if(!recorder_)
+            return;
+        recorder_->record(id_, FlightEvent::request_end, status);
+        recorder_.reset();
+    }
+};
+
+#endif // FLIGHT_RECORDER_HPP
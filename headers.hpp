@@ -0,0 +1,196 @@
+#ifndef HEADERS_HPP
+#define HEADERS_HPP
+//include build options
+#include "httpConfig.hpp"
+//include beast
+#include <boost/beast/core/string.hpp>
+#include <boost/beast/http/field.hpp>
+#include <boost/beast/http/fields.hpp>
+//include flat inline storage
+#include <boost/container/small_vector.hpp>
+//include others
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <string>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+// A single request header, named either by a well known http::field
+// or by an arbitrary string. Well known names given as strings are
+// resolved to their http::field once, on construction.
+class Header
+{
+    http::field field_;
+    std::string name_;
+    std::string value_;
+    std::uint32_t hash_;
+
+public:
+    // Case-insensitive FNV-1a, so lookups compare hashes before names
+    static std::uint32_t
+    hash(beast::string_view name)
+    {
+        std::uint32_t h = 2166136261u;
+        for(unsigned char c : name){
+            if(c >= 'A' && c <= 'Z')
+                c += 'a' - 'A';
+            h = (h ^ c) * 16777619u;
+        }
+        return h;
+    }
+
+    Header(http::field field, beast::string_view value)
+        : field_(field)
+        , value_(value)
+        , hash_(hash(http::to_string(field)))
+    {
+    }
+
+    Header(beast::string_view name, beast::string_view value)
+        : field_(http::string_to_field(name))
+        , value_(value)
+        , hash_(hash(name))
+    {
+        if(field_ == http::field::unknown)
+            name_ = std::string(name);
+    }
+
+    Header(const char* name, const char* value)
+        : Header(beast::string_view(name), beast::string_view(value))
+    {
+    }
+
+    http::field field() const { return field_; }
+    std::uint32_t hash() const { return hash_; }
+    const std::string& value() const { return value_; }
+    std::string& value() { return value_; }
+
+    beast::string_view
+    name() const
+    {
+        if(field_ != http::field::unknown)
+            return http::to_string(field_);
+        return name_;
+    }
+};
+
+// Flat, case-insensitive request header set with inline room for the
+// handful of headers a typical request carries, so building one does
+// not allocate per entry the way std::map does.
+//
+//   Headers headers{
+//       {http::field::content_type, "application/json"},
+//       {"X-Request-Id", "42"}
+//   };
+class Headers
+{
+    using storage_type = boost::container::small_vector<Header, 8>;
+    storage_type entries_;
+
+public:
+    using const_iterator = storage_type::const_iterator;
+
+    Headers() = default;
+
+    Headers(std::initializer_list<Header> headers)
+        : entries_(headers.begin(), headers.end())
+    {
+    }
+
+    // Keeps existing std::map based callers compiling
+    Headers(const std::map<std::string, std::string>& headers)
+    {
+        entries_.reserve(headers.size());
+        for(auto& pair : headers){
+            entries_.emplace_back(pair.first, pair.second);
+        }
+    }
+
+    const_iterator begin() const { return entries_.begin(); }
+    const_iterator end() const { return entries_.end(); }
+    std::size_t size() const { return entries_.size(); }
+    bool empty() const { return entries_.empty(); }
+
+    const_iterator
+    find(http::field field) const
+    {
+        for(auto it = entries_.begin(); it != entries_.end(); ++it){
+            if(it->field() == field)
+                return it;
+        }
+        return entries_.end();
+    }
+
+    const_iterator
+    find(beast::string_view name) const
+    {
+        auto field = http::string_to_field(name);
+        if(field != http::field::unknown)
+            return find(field);
+
+        auto h = Header::hash(name);
+        for(auto it = entries_.begin(); it != entries_.end(); ++it){
+            if(it->hash() == h && it->field() == http::field::unknown &&
+                beast::iequals(it->name(), name))
+                return it;
+        }
+        return entries_.end();
+    }
+
+    template<class Name>
+    bool contains(const Name& name) const { return find(name) != end(); }
+
+    // Value of the header, or an empty view if it is not set
+    template<class Name>
+    beast::string_view
+    get(const Name& name) const
+    {
+        auto it = find(name);
+        if(it == end())
+            return {};
+        return it->value();
+    }
+
+    // Append a header, keeping any existing ones with the same name
+    template<class Name>
+    void
+    insert(const Name& name, beast::string_view value)
+    {
+        entries_.emplace_back(name, value);
+    }
+
+    // Replace every header with the same name by a single one
+    template<class Name>
+    void
+    set(const Name& name, beast::string_view value)
+    {
+        erase(name);
+        entries_.emplace_back(name, value);
+    }
+
+    template<class Name>
+    void
+    erase(const Name& name)
+    {
+        for(auto it = find(name); it != end(); it = find(name)){
+            entries_.erase(entries_.begin() + (it - entries_.begin()));
+        }
+    }
+
+    // Copy into the request's fields. Well known headers go in by
+    // enum, which skips beast's name lookup.
+    void
+    apply(http::fields& fields) const
+    {
+        for(auto& header : entries_){
+            if(header.field() != http::field::unknown)
+                fields.insert(header.field(), header.value());
+            else
+                fields.insert(header.name(), header.value());
+        }
+    }
+};
+
+#endif // HEADERS_HPP
@@ -1,5 +1,9 @@
 #ifndef HTTP_HPP
 #define HTTP_HPP
+//include build options
+#include "httpConfig.hpp"
+//include the client's declaration
+#include "httpClient.hpp"
 
 //include asio
 #include <boost/asio.hpp>
@@ -12,10 +16,22 @@
 //include certify for ssl
 #include <boost/certify/extensions.hpp>
 #include <boost/certify/https_verification.hpp>
+//include shared loop, pool and caches
+#include "clientContext.hpp"
+#include "shardedClientContext.hpp"
+//include request headers
+#include "headers.hpp"
+//include ranged downloads
+#include "download.hpp"
 //include other
 #include <boost/lexical_cast.hpp>
-#include <map>
+#include <atomic>
+#include <cstdlib>
+#include <future>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace beast = boost::beast;
 namespace asio = boost::asio;
@@ -23,42 +39,112 @@ namespace ssl = asio::ssl;
 namespace http = boost::beast::http;
 using tcp = boost::asio::ip::tcp;
 
-class HttpClient {
-    private:
-        auto getSocket(asio::io_context& io, const std::string& host, const char* type);
-        auto connect_with_ssl(const std::string& host);
-        auto connect(const std::string& host);
-        auto parse_url(std::string& url, std::string& type, std::string& host, std::string& path);
-        template<class requestType>
-        auto execute_request(
-            const std::string& type, 
-            const std::string& host, 
-            const http::request<requestType>& request
-        );
-        template<class requestType>
-        void send_request(
-            std::unique_ptr<ssl::stream<tcp::socket>> socket_ptr, 
-            const http::request<requestType>& request, 
-            http::response<http::string_body>& response
-        );
-        template<class requestType>
-        void send_request(
-            std::unique_ptr<tcp::socket> socket_ptr, 
-            const http::request<requestType>& request, 
-            http::response<http::string_body>& response
-        );
+//with separate compilation only httpClient.cpp defines the client
+#if !defined(HTTP_CLIENT_SEPARATE_COMPILATION) || defined(HTTP_CLIENT_SOURCE)
 
-    public:
-        HttpClient(){}  //empty to make the client stateless
-        auto get(std::string url, const std::map<std::string, std::string> &headers);
-        auto post(std::string url, const char *body, const std::map<std::string, std::string> &headers);
-        auto delete_(std::string url, const std::map<std::string, std::string> &headers);
-        auto put(std::string url, const char *body, const std::map<std::string, std::string> &headers);
+// What HttpClient's requests are made of, kept out of httpClient.hpp so
+// the public header needs neither asio nor beast's streams
+struct HttpClient::Impl {
+    HttpClient& client_;
+    //the request's steps, if the context traces them
+    FlightTrace trace_;
+    ClientContext& context(){ return client_.shards_ ? client_.shards_->local() : *client_.context_; }
+    auto getSocket(const std::string& host, const char* type);
+    auto connect_with_ssl(const std::string& host);
+    auto connect(const std::string& host);
+    auto connect_unix(const std::string& path);
+    auto parse_url(std::string& url, std::string& type, std::string& host, std::string& path);
+    template<class requestType>
+    auto execute_request(
+        const std::string& type, 
+        const std::string& host, 
+        http::request<requestType>& request
+    );
+    template<class requestType>
+    beast::error_code send_request(
+        std::unique_ptr<SslStream> socket_ptr, 
+        const std::string& key,
+        http::request<requestType>& request, 
+        http::response<http::string_body>& response
+    );
+    template<class requestType>
+    beast::error_code send_request(
+        std::unique_ptr<PlainStream> socket_ptr, 
+        const std::string& key,
+        http::request<requestType>& request, 
+        http::response<http::string_body>& response
+    );
+    template<class requestType>
+    beast::error_code send_request(
+        std::unique_ptr<UnixStream> socket_ptr, 
+        const std::string& key,
+        http::request<requestType>& request, 
+        http::response<http::string_body>& response
+    );
+    std::unique_ptr<PlainStream> open_stream(const std::string& host, PlainStream*);
+    std::unique_ptr<SslStream> open_stream(const std::string& host, SslStream*);
+    std::unique_ptr<UnixStream> open_stream(const std::string& path, UnixStream*);
+    void close_stream(std::unique_ptr<PlainStream> socket_ptr);
+    void close_stream(std::unique_ptr<SslStream> socket_ptr);
+    void close_stream(std::unique_ptr<UnixStream> socket_ptr);
+    static beast::error_code check_range(
+        const http::response_parser<http::buffer_body>& parser,
+        bool ranged,
+        const ByteRange& range
+    );
+    template<class Stream>
+    beast::error_code probe(
+        const std::string& type,
+        const std::string& host,
+        const http::request<http::empty_body>& request,
+        std::uint64_t& size,
+        bool& ranges,
+        bool& reused
+    );
+    template<class Stream>
+    beast::error_code read_body(
+        Stream& stream,
+        beast::flat_buffer& buffer,
+        http::response_parser<http::buffer_body>& parser,
+        ByteRange& range,
+        MappedFile& output,
+        const std::function<void(std::int64_t)>& received
+    );
+    template<class Stream>
+    beast::error_code fetch_range(
+        const std::string& type,
+        const std::string& host,
+        http::request<http::empty_body> request,
+        bool ranged,
+        ByteRange& range,
+        MappedFile& output,
+        const std::function<void(std::int64_t)>& received,
+        bool& reused
+    );
+    template<class Stream>
+    std::uint64_t download_from(
+        const std::string& type,
+        const std::string& host,
+        const http::request<http::empty_body>& request,
+        const std::string& file,
+        const DownloadOptions& options
+    );
 };
 
+HTTP_CLIENT_DECL
+HttpClient::HttpClient()
+    : context_(ClientContext::shared()){}
+
+HTTP_CLIENT_DECL
+HttpClient::HttpClient(std::shared_ptr<ClientContext> context)
+    : context_(std::move(context)){}
 
-auto 
-HttpClient::parse_url(
+HTTP_CLIENT_DECL
+HttpClient::HttpClient(std::shared_ptr<ShardedClientContext> shards)
+    : shards_(std::move(shards)){}
+
+inline auto 
+HttpClient::Impl::parse_url(
     std::string& url, 
     std::string& type, 
     std::string& host, 
@@ -69,6 +155,15 @@ HttpClient::parse_url(
     type = url.substr(0, column_index);
 
     url = url.substr(column_index + 3);
+
+    //unix:///path/to.sock:/request/path, the socket path stands in for the host
+    if(type == "unix"){
+        auto path_index = url.find(':');
+        host = url.substr(0, path_index);
+        path = path_index == std::string::npos ? "/" : url.substr(path_index + 1);
+        return;
+    }
+
     try{
         unsigned short slash_index =  url.find('/');
         host = url.substr(0, slash_index);
@@ -79,124 +174,358 @@ HttpClient::parse_url(
     }
 }
 
-auto
-HttpClient::getSocket(
-    asio::io_context& io, 
+inline auto
+HttpClient::Impl::getSocket(
     const std::string& host, 
     const char* type
 ){   
-    tcp::resolver resolver{io};
-    tcp::socket socket{io};
-    asio::connect(socket, resolver.resolve(host, type));
-    return socket;
+    //resolve through the shared cache
+    trace_.record(FlightEvent::resolve_begin);
+    tcp::resolver::results_type results;
+    if(!context().dns().lookup(host, type, results)){
+        tcp::resolver resolver{context().io()};
+        results = resolver.resolve(host, type);
+        context().dns().store(host, type, results);
+    }
+    trace_.record(FlightEvent::resolve_end);
+    trace_.record(FlightEvent::connect_begin);
+
+    //the stream is bound to the shared io context so it can be pooled
+    auto& io = context().io();
+
+    //called from an async callback the loop can't race for us,
+    //so try the addresses one by one in the balancer's order
+    if(io.get_executor().running_in_this_thread()){
+        beast::error_code ec = asio::error::host_not_found;
+        auto profile = context().socket_profile(host);
+        for(auto& endpoint : context().balancer().order(results)){
+            tcp::socket socket{io};
+            socket.open(endpoint.protocol(), ec);
+            if(!ec){
+                apply_socket_profile(socket, profile);
+            }
+            socket.connect(endpoint, ec);
+            if(!ec){
+                trace_.record(FlightEvent::connect_end);
+                return beast::tcp_stream(std::move(socket));
+            }
+            context().balancer().connect_failed(endpoint);
+        }
+        context().dns().evict(host, type);
+        throw beast::system_error{ec};
+    }
+
+    //otherwise race the addresses on the loop and wait for the winner
+    std::promise<tcp::socket> connected;
+    auto socket = connected.get_future();
+    asio::post(io, [&]{
+        context().async_connect(results, std::chrono::seconds(30), 
+            [&](beast::error_code ec, tcp::socket socket, tcp::endpoint){
+                if(ec){
+                    connected.set_exception(std::make_exception_ptr(beast::system_error{ec}));
+                }else{
+                    connected.set_value(std::move(socket));
+                }
+            }
+        );
+    });
+
+    try{
+        auto stream = beast::tcp_stream(socket.get());
+        trace_.record(FlightEvent::connect_end);
+        return stream;
+    }catch(beast::system_error&){
+        context().dns().evict(host, type);
+        throw;
+    }
 }
 
-auto 
-HttpClient::connect_with_ssl(
+inline auto 
+HttpClient::Impl::connect_with_ssl(
     const std::string& host
 ){
-    //Create io context
-    asio::io_context io;
-        
-    //create ssl context
-    ssl::context ssl{ssl::context::tls_client};
-    ssl.set_verify_mode(ssl::context::verify_peer | ssl::context::verify_fail_if_no_peer_cert);
-    ssl.set_default_verify_paths();
-    boost::certify::enable_native_https_server_verification(ssl);
-
     //get the socket and make ssl handsake
-    auto socket_ptr = boost::make_unique<ssl::stream<tcp::socket>>(getSocket(io, host, "https"), ssl);
+    auto socket_ptr = boost::make_unique<SslStream>(getSocket(host, "https"), context().ssl());
     boost::certify::set_server_hostname(*socket_ptr, host); 
     boost::certify::sni_hostname(*socket_ptr, host);
+    trace_.record(FlightEvent::handshake_begin);
     socket_ptr->handshake(ssl::stream_base::handshake_type::client);
+    trace_.record(FlightEvent::handshake_end);
+
+    //hand the encryption to the kernel if opted in
+    if(context().ktls()){
+        ktls_enable_tx(*socket_ptr);
+    }
 
     return socket_ptr;
 }
 
-auto
-HttpClient::connect(
+inline auto
+HttpClient::Impl::connect(
     const std::string& host
 ){
+    return boost::make_unique<PlainStream>(getSocket(host, "http"));
+}
+
+inline auto
+HttpClient::Impl::connect_unix(
+    const std::string& path
+){
+    //a local socket needs no resolve, the path is the address
+    auto socket_ptr = boost::make_unique<UnixStream>(context().io());
+    trace_.record(FlightEvent::connect_begin);
+    socket_ptr->socket().connect(asio::local::stream_protocol::endpoint(path));
+    trace_.record(FlightEvent::connect_end);
 
-    //Create io context and socket
-    asio::io_context io;
-    return boost::make_unique<tcp::socket>(getSocket(io, host, "http"));
+    return socket_ptr;
 }
 
 
 template<class requestType>
-void
-HttpClient::send_request(
-    std::unique_ptr<ssl::stream<tcp::socket>> socket_ptr, 
-    const http::request<requestType>& request,
+beast::error_code
+HttpClient::Impl::send_request(
+    std::unique_ptr<SslStream> socket_ptr, 
+    const std::string& key,
+    http::request<requestType>& request,
     http::response<http::string_body>& response
 ){
 
+    //measure the exchange against the address it went to
+    beast::error_code ec;
+    auto endpoint = beast::get_lowest_layer(*socket_ptr).socket().remote_endpoint(ec);
+    auto sent_at = std::chrono::steady_clock::now();
+    context().balancer().begin(endpoint);
+
     //send the request
-    http::write(*socket_ptr, request);
+    write_request(*socket_ptr, request, ec);
 
-    //get the response
+    //get the response, past any interim 1xx ones
     beast::flat_buffer buffer;
-    http::read(*socket_ptr, buffer, response);
+    if(!ec){
+        read_response(*socket_ptr, buffer, response, ec, &trace_);
+    }
 
-    //Close the connection
-    beast::error_code ec;
-    socket_ptr->shutdown(ec);
-    socket_ptr->next_layer().close(ec);
+    if(ec){
+        //a stale pooled connection says nothing about the address
+        if(is_stale_connection(ec)){
+            context().balancer().abandon(endpoint);
+        }else{
+            context().balancer().end(endpoint, std::chrono::steady_clock::now() - sent_at, false);
+        }
+        return ec;
+    }
+    context().balancer().end(endpoint, std::chrono::steady_clock::now() - sent_at, response.result_int() < 500);
+
+    //park the connection for the next request if the server allows it
+    if(response.keep_alive()){
+        context().pool().release(key, std::move(socket_ptr));
+        return {};
+    }
+
+    //Close the connection, OpenSSL can't send close_notify once the kernel encrypts
+    if(!ktls_tx_active(*socket_ptr)){
+        socket_ptr->shutdown(ec);
+    }
+    if(ec == asio::error::eof || ec == ssl::error::stream_truncated){
+        ec = {};
+    }
+    beast::error_code ignored;
+    socket_ptr->next_layer().socket().close(ignored);
     if(ec){
         throw beast::system_error{ec};
     }
+    return {};
 }
 
 template<class requestType>
-void
-HttpClient::send_request(
-    std::unique_ptr<tcp::socket> socket_ptr, 
-    const http::request<requestType>& request,
+beast::error_code
+HttpClient::Impl::send_request(
+    std::unique_ptr<PlainStream> socket_ptr, 
+    const std::string& key,
+    http::request<requestType>& request,
     http::response<http::string_body>& response
 ){
 
-    //send the request
-    http::write(*socket_ptr, request);
+    //measure the exchange against the address it went to. With Fast Open
+    //a new connection has no peer until the server answers its SYN
+    beast::error_code ec;
+    auto endpoint = beast::get_lowest_layer(*socket_ptr).socket().remote_endpoint(ec);
+    bool connected = !ec;
+    auto sent_at = std::chrono::steady_clock::now();
+    context().balancer().begin(endpoint);
 
-    //get the response
+    //send the request, a large body straight from its pages if the profile allows
+    ZerocopyTracker zerocopy;
+    ec = {};
+    if(!write_zerocopy(*socket_ptr, request, zerocopy, ec)){
+        write_request(*socket_ptr, request, ec);
+    }
+
+    //get the response, past any interim 1xx ones
     beast::flat_buffer buffer;
-    http::read(*socket_ptr, buffer, response);
+    if(!ec){
+        read_response(*socket_ptr, buffer, response, ec, &trace_);
+    }
+
+    //the kernel may still read the body's pages until they are acknowledged
+    if(!ec){
+        zerocopy.wait(socket_ptr->socket(), ec);
+    }
+
+    if(!connected){
+        beast::error_code ignored;
+        endpoint = socket_ptr->socket().remote_endpoint(ignored);
+        context().balancer().begin(endpoint);
+    }
+
+    if(ec){
+        //a stale pooled connection says nothing about the address
+        if(is_stale_connection(ec)){
+            context().balancer().abandon(endpoint);
+        }else{
+            context().balancer().end(endpoint, std::chrono::steady_clock::now() - sent_at, false);
+        }
+        return ec;
+    }
+    context().balancer().end(endpoint, std::chrono::steady_clock::now() - sent_at, response.result_int() < 500);
+
+    //park the connection for the next request if the server allows it
+    if(response.keep_alive()){
+        context().pool().release(key, std::move(socket_ptr));
+        return {};
+    }
 
     //Close the connection
+    socket_ptr->socket().shutdown(tcp::socket::shutdown_both, ec);
+    if(ec && ec != beast::errc::not_connected){
+        throw beast::system_error{ec};
+    }
+    return {};
+}
+
+template<class requestType>
+beast::error_code
+HttpClient::Impl::send_request(
+    std::unique_ptr<UnixStream> socket_ptr, 
+    const std::string& key,
+    http::request<requestType>& request,
+    http::response<http::string_body>& response
+){
+
+    //send the request
     beast::error_code ec;
-    socket_ptr->shutdown(tcp::socket::shutdown_both, ec);
+    write_request(*socket_ptr, request, ec);
+
+    //get the response, past any interim 1xx ones
+    beast::flat_buffer buffer;
+    if(!ec){
+        read_response(*socket_ptr, buffer, response, ec, &trace_);
+    }
     if(ec){
+        return ec;
+    }
+
+    //park the connection for the next request if the server allows it
+    if(response.keep_alive()){
+        context().pool().release(key, std::move(socket_ptr));
+        return {};
+    }
+
+    //Close the connection
+    socket_ptr->socket().shutdown(asio::local::stream_protocol::socket::shutdown_both, ec);
+    if(ec && ec != beast::errc::not_connected){
         throw beast::system_error{ec};
     }
+    return {};
 }
 
 template<class requestType>
 auto
-HttpClient::execute_request(
+HttpClient::Impl::execute_request(
     const std::string& type, 
     const std::string& host, 
-    const http::request<requestType>& request
+    http::request<requestType>& request
 ){
 
+    if(auto recorder = context().recorder()){
+        recorder->record(type, host, request);
+    }
+    trace_ = FlightTrace(context().flight_recorder(), host);
+
     http::response<http::string_body> response;
+    auto key = type + "://" + host;
 
     if(type == "https"){
 
-        //construct the socket and connect
-        auto socket_ptr = connect_with_ssl(host);
+        //take an idle pooled connection, or connect a new one
+        auto socket_ptr = context().pool().acquire<SslStream>(key, context().scorer());
+        bool reused = socket_ptr != nullptr;
+        if(reused){
+            trace_.record(FlightEvent::pool_reuse);
+        }else{
+            socket_ptr = connect_with_ssl(host);
+        }
         //send the request
-        send_request<requestType>(std::move(socket_ptr), request, response);
+        auto ec = send_request<requestType>(std::move(socket_ptr), key, request, response);
+        //the server may have dropped the idle connection, retry once on a fresh one
+        if(ec && reused && is_stale_connection(ec)){
+            trace_.record(FlightEvent::retry);
+            response = {};
+            ec = send_request<requestType>(connect_with_ssl(host), key, request, response);
+        }
+        if(ec){
+            trace_.error(ec);
+            throw beast::system_error{ec};
+        }
 
     }else if(type == "http"){
 
-        //construct the socket and connect
-        auto socket_ptr = connect(host);
+        //take an idle pooled connection, or connect a new one
+        auto socket_ptr = context().pool().acquire<PlainStream>(key, context().scorer());
+        bool reused = socket_ptr != nullptr;
+        if(reused){
+            trace_.record(FlightEvent::pool_reuse);
+        }else{
+            socket_ptr = connect(host);
+        }
         //send the request
-        send_request<requestType>(std::move(socket_ptr), request, response);
+        auto ec = send_request<requestType>(std::move(socket_ptr), key, request, response);
+        //the server may have dropped the idle connection, retry once on a fresh one
+        if(ec && reused && is_stale_connection(ec)){
+            trace_.record(FlightEvent::retry);
+            response = {};
+            ec = send_request<requestType>(connect(host), key, request, response);
+        }
+        if(ec){
+            trace_.error(ec);
+            throw beast::system_error{ec};
+        }
         
+    }else if(type == "unix"){
+
+        //take an idle pooled connection, or connect a new one
+        auto socket_ptr = context().pool().acquire<UnixStream>(key);
+        bool reused = socket_ptr != nullptr;
+        if(reused){
+            trace_.record(FlightEvent::pool_reuse);
+        }else{
+            socket_ptr = connect_unix(host);
+        }
+        //send the request
+        auto ec = send_request<requestType>(std::move(socket_ptr), key, request, response);
+        //the server may have dropped the idle connection, retry once on a fresh one
+        if(ec && reused && is_stale_connection(ec)){
+            trace_.record(FlightEvent::retry);
+            response = {};
+            ec = send_request<requestType>(connect_unix(host), key, request, response);
+        }
+        if(ec){
+            trace_.error(ec);
+            throw beast::system_error{ec};
+        }
+
     }else{
-        std::cout << "ONLY HTTP/HTTPS SUPPORTED! \n";
+        std::cout << "ONLY HTTP/HTTPS/UNIX SUPPORTED! \n";
         std::terminate();
     }
 
@@ -206,38 +535,479 @@ HttpClient::execute_request(
         std::cout << "Response Body: " << response.body() << "\n";
     }
 
+    trace_.end(response.result_int());
     return response.body();
 }
 
+inline std::unique_ptr<PlainStream>
+HttpClient::Impl::open_stream(
+    const std::string& host,
+    PlainStream*
+){
+    return connect(host);
+}
+
+inline std::unique_ptr<SslStream>
+HttpClient::Impl::open_stream(
+    const std::string& host,
+    SslStream*
+){
+    return connect_with_ssl(host);
+}
+
+inline std::unique_ptr<UnixStream>
+HttpClient::Impl::open_stream(
+    const std::string& path,
+    UnixStream*
+){
+    return connect_unix(path);
+}
+
+inline void
+HttpClient::Impl::close_stream(
+    std::unique_ptr<PlainStream> socket_ptr
+){
+    //the data is already in, a failed close changes nothing
+    beast::error_code ignored;
+    socket_ptr->socket().shutdown(tcp::socket::shutdown_both, ignored);
+}
+
+inline void
+HttpClient::Impl::close_stream(
+    std::unique_ptr<SslStream> socket_ptr
+){
+    //the data is already in, a failed close changes nothing
+    beast::error_code ignored;
+    if(!ktls_tx_active(*socket_ptr)){
+        socket_ptr->shutdown(ignored);
+    }
+    socket_ptr->next_layer().socket().close(ignored);
+}
+
+inline void
+HttpClient::Impl::close_stream(
+    std::unique_ptr<UnixStream> socket_ptr
+){
+    //the data is already in, a failed close changes nothing
+    beast::error_code ignored;
+    socket_ptr->socket().shutdown(asio::local::stream_protocol::socket::shutdown_both, ignored);
+}
+
+inline beast::error_code
+HttpClient::Impl::check_range(
+    const http::response_parser<http::buffer_body>& parser,
+    bool ranged,
+    const ByteRange& range
+){
+    auto& response = parser.get();
+    auto expected = ranged ? http::status::partial_content : http::status::ok;
+    if(response.result() != expected){
+        std::cout << "HTTP ERROR: " << response.result() << "\n";
+        std::cout << "Status Code: " << response.result_int() << "\n";
+        return beast::errc::make_error_code(beast::errc::protocol_error);
+    }
+
+    //the server has to answer from the first byte asked for
+    if(ranged){
+        auto content_range = std::string(response[http::field::content_range]);
+        if(content_range.compare(0, 6, "bytes ") != 0 ||
+            std::strtoull(content_range.c_str() + 6, nullptr, 10) != range.offset){
+            return beast::errc::make_error_code(beast::errc::protocol_error);
+        }
+    }
+
+    //and send exactly what is missing, the resource may have changed
+    if(range.bounded() && parser.content_length() && *parser.content_length() != range.left()){
+        return beast::errc::make_error_code(beast::errc::protocol_error);
+    }
+    return {};
+}
+
+template<class Stream>
+beast::error_code
+HttpClient::Impl::probe(
+    const std::string& type,
+    const std::string& host,
+    const http::request<http::empty_body>& request,
+    std::uint64_t& size,
+    bool& ranges,
+    bool& reused
+){
+    auto key = type + "://" + host;
+
+    //take an idle pooled connection, or connect a new one
+    auto socket_ptr = context().pool().acquire<Stream>(key, context().scorer());
+    reused = socket_ptr != nullptr;
+    if(!reused){
+        socket_ptr = open_stream(host, static_cast<Stream*>(nullptr));
+    }
+
+    //measure the exchange against the address it went to
+    beast::error_code ec;
+    auto endpoint = remote_endpoint(*socket_ptr, ec);
+    auto sent_at = std::chrono::steady_clock::now();
+    context().balancer().begin(endpoint);
+
+    //send the HEAD request, its response has no body to read
+    beast::flat_buffer buffer;
+    http::response_parser<http::empty_body> parser;
+    parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+    parser.skip(true);
+    write_request(*socket_ptr, request, ec);
+    if(!ec){
+        http::read(*socket_ptr, buffer, parser, ec);
+    }
+
+    if(ec){
+        //a stale pooled connection says nothing about the address
+        if(is_stale_connection(ec)){
+            context().balancer().abandon(endpoint);
+        }else{
+            context().balancer().end(endpoint, std::chrono::steady_clock::now() - sent_at, false);
+        }
+        return ec;
+    }
+    auto& response = parser.get();
+    context().balancer().end(endpoint, std::chrono::steady_clock::now() - sent_at, response.result_int() < 500);
+
+    //a server that doesn't answer HEAD gets a single plain GET
+    if(response.result() == http::status::ok){
+        auto length = response[http::field::content_length];
+        if(!length.empty()){
+            size = std::strtoull(std::string(length).c_str(), nullptr, 10);
+        }
+        ranges = beast::iequals(response[http::field::accept_ranges], "bytes");
+    }
+
+    //park the connection for the ranges if the server allows it
+    if(response.keep_alive()){
+        context().pool().release(key, std::move(socket_ptr));
+    }else{
+        close_stream(std::move(socket_ptr));
+    }
+    return {};
+}
+
+template<class Stream>
+beast::error_code
+HttpClient::Impl::read_body(
+    Stream& stream,
+    beast::flat_buffer& buffer,
+    http::response_parser<http::buffer_body>& parser,
+    ByteRange& range,
+    MappedFile& output,
+    const std::function<void(std::int64_t)>& received
+){
+    //reads are capped so progress is reported while the body arrives
+    constexpr std::uint64_t slice = 1024 * 1024;
+    std::vector<char> scratch;
+    beast::error_code ec;
+
+    //with a known length the body is read straight into the mapping,
+    //skipping the parser's copy out of the read buffer
+    if(parser.content_length() && !parser.chunked()){
+        auto remaining = *parser.content_length();
+
+        //body bytes that arrived together with the header
+        auto early = std::min<std::uint64_t>(buffer.size(), remaining);
+        if(early > 0){
+            ec = output.write(static_cast<const char*>(buffer.data().data()), early, range.offset);
+            if(ec){
+                return ec;
+            }
+            buffer.consume(early);
+            range.offset += early;
+            remaining -= early;
+            received(early);
+        }
+
+        while(remaining > 0){
+            auto step = std::min(remaining, slice);
+            std::size_t read;
+            if(output.data()){
+                read = asio::read(stream, asio::buffer(output.data() + range.offset, step), ec);
+            }else{
+                scratch.resize(step);
+                read = asio::read(stream, asio::buffer(scratch.data(), step), ec);
+                if(read > 0){
+                    auto write_ec = output.write(scratch.data(), read, range.offset);
+                    if(write_ec){
+                        return write_ec;
+                    }
+                }
+            }
+            range.offset += read;
+            remaining -= read;
+            if(read > 0){
+                received(read);
+            }
+            if(ec){
+                return ec;
+            }
+        }
+        return {};
+    }
+
+    //chunked or close delimited bodies go through the parser
+    if(!output.data()){
+        scratch.resize(slice);
+    }
+    while(!parser.is_done()){
+        auto step = slice;
+        auto dest = scratch.data();
+        if(output.data()){
+            if(range.left() == 0){
+                return http::error::body_limit;
+            }
+            step = std::min(range.left(), slice);
+            dest = output.data() + range.offset;
+        }
+        parser.get().body().data = dest;
+        parser.get().body().size = step;
+
+        http::read(stream, buffer, parser, ec);
+        if(ec == http::error::need_buffer){
+            ec = {};
+        }
+
+        auto read = step - parser.get().body().size;
+        if(read > 0 && !output.data()){
+            auto write_ec = output.write(scratch.data(), read, range.offset);
+            if(write_ec){
+                return write_ec;
+            }
+        }
+        range.offset += read;
+        if(read > 0){
+            received(read);
+        }
+        if(ec){
+            return ec;
+        }
+    }
+    if(range.bounded() && range.left() != 0){
+        return http::error::partial_message;
+    }
+    return {};
+}
+
+template<class Stream>
+beast::error_code
+HttpClient::Impl::fetch_range(
+    const std::string& type,
+    const std::string& host,
+    http::request<http::empty_body> request,
+    bool ranged,
+    ByteRange& range,
+    MappedFile& output,
+    const std::function<void(std::int64_t)>& received,
+    bool& reused
+){
+    auto key = type + "://" + host;
+    if(ranged){
+        request.set(http::field::range, 
+            "bytes=" + std::to_string(range.offset) + "-" + std::to_string(range.end - 1));
+    }
+
+    //take an idle pooled connection, or connect a new one
+    auto socket_ptr = context().pool().acquire<Stream>(key, context().scorer());
+    reused = socket_ptr != nullptr;
+    if(!reused){
+        socket_ptr = open_stream(host, static_cast<Stream*>(nullptr));
+    }
+
+    //measure the exchange against the address it went to
+    beast::error_code ec;
+    auto endpoint = remote_endpoint(*socket_ptr, ec);
+    auto sent_at = std::chrono::steady_clock::now();
+    context().balancer().begin(endpoint);
+
+    //send the request and read the response header
+    beast::flat_buffer buffer;
+    http::response_parser<http::buffer_body> parser;
+    parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+    write_request(*socket_ptr, request, ec);
+    if(!ec){
+        http::read_header(*socket_ptr, buffer, parser, ec);
+    }
+
+    //an unexpected answer is the server's call, not an I/O failure
+    if(!ec){
+        auto status_ec = check_range(parser, ranged, range);
+        if(status_ec){
+            context().balancer().end(endpoint, std::chrono::steady_clock::now() - sent_at, 
+                parser.get().result_int() < 500);
+            return status_ec;
+        }
+        ec = read_body(*socket_ptr, buffer, parser, range, output, received);
+    }
+
+    if(ec){
+        //a stale pooled connection says nothing about the address
+        if(is_stale_connection(ec)){
+            context().balancer().abandon(endpoint);
+        }else{
+            context().balancer().end(endpoint, std::chrono::steady_clock::now() - sent_at, false);
+        }
+        return ec;
+    }
+    context().balancer().end(endpoint, std::chrono::steady_clock::now() - sent_at, true);
+
+    //park the connection for the next range if the server allows it
+    if(parser.get().keep_alive()){
+        context().pool().release(key, std::move(socket_ptr));
+    }else{
+        close_stream(std::move(socket_ptr));
+    }
+    return {};
+}
+
+template<class Stream>
+std::uint64_t
+HttpClient::Impl::download_from(
+    const std::string& type,
+    const std::string& host,
+    const http::request<http::empty_body>& request,
+    const std::string& file,
+    const DownloadOptions& options
+){
+    //ask for the size and whether byte ranges are served
+    auto head = request;
+    head.method(http::verb::head);
+    std::uint64_t size = ByteRange::npos;
+    bool ranges = false;
+    bool reused = false;
+    auto ec = probe<Stream>(type, host, head, size, ranges, reused);
+    //the server may have dropped the idle connection, retry once on a fresh one
+    if(ec && reused && is_stale_connection(ec)){
+        ec = probe<Stream>(type, host, head, size, ranges, reused);
+    }
+    if(ec){
+        throw beast::system_error{ec};
+    }
+
+    MappedFile output(file, size);
+    if(size == 0){
+        return 0;
+    }
+
+    //cut the resource into ranges, at least one per connection
+    auto connections = std::max<std::size_t>(1, options.connections);
+    std::vector<ByteRange> chunks;
+    if(ranges && size != ByteRange::npos){
+        auto per_connection = (size + connections - 1) / connections;
+        auto chunk = std::max<std::uint64_t>(1, std::min(options.chunk_size, per_connection));
+        for(std::uint64_t offset = 0; offset < size; offset += chunk){
+            ByteRange range;
+            range.offset = offset;
+            range.end = std::min(offset + chunk, size);
+            chunks.push_back(range);
+        }
+    }else{
+        ranges = false;
+        ByteRange range;
+        range.end = size;
+        chunks.push_back(range);
+    }
+
+    //progress calls and the first error are serialized
+    std::mutex mutex;
+    std::uint64_t received = 0;
+    beast::error_code error;
+    std::atomic<bool> failed{false};
+    std::atomic<std::size_t> next{0};
+    auto total = size == ByteRange::npos ? 0 : size;
+
+    std::function<void(std::int64_t)> report = [&](std::int64_t bytes){
+        std::lock_guard<std::mutex> lock(mutex);
+        received += bytes;
+        if(options.progress){
+            options.progress(received, total);
+        }
+    };
+
+    //each worker takes the next free range until none are left
+    auto worker = [&]{
+        for(auto index = next++; index < chunks.size() && !failed; index = next++){
+            auto& range = chunks[index];
+            for(;;){
+                auto before = range.offset;
+                bool reused = false;
+                beast::error_code ec;
+                try{
+                    ec = fetch_range<Stream>(type, host, request, ranges, range, output, report, reused);
+                }catch(beast::system_error& ex){
+                    ec = ex.code();
+                }
+                if(!ec){
+                    break;
+                }
+
+                //a dropped idle connection costs nothing, anything else is a failure
+                if(!(reused && is_stale_connection(ec) && range.offset == before)){
+                    ++range.failures;
+                }
+                if(range.failures > options.retries || failed){
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if(!failed.exchange(true)){
+                        error = ec;
+                    }
+                    return;
+                }
+
+                //without ranges the body can only be fetched again from the start
+                if(!ranges && range.offset > 0){
+                    report(-static_cast<std::int64_t>(range.offset));
+                    range.offset = 0;
+                }
+            }
+        }
+    };
+
+    //the calling thread fetches too
+    std::vector<std::thread> workers;
+    for(std::size_t i = 1; i < std::min(connections, chunks.size()); ++i){
+        workers.emplace_back(worker);
+    }
+    worker();
+    for(auto& thread : workers){
+        thread.join();
+    }
+
+    if(failed){
+        throw beast::system_error{error};
+    }
+    return received;
+}
+
 /*
 Make a Http GET request.
 @param url: The URL for the request
 @param headers: Http request headers if any
 @returns response body
 */
-auto
+HTTP_CLIENT_DECL std::string
 HttpClient::get(
     std::string url, 
-    const std::map<std::string, std::string> &headers = {}
+    const Headers &headers
 ){   
     //parse the url
     std::string host;
     std::string type;
     std::string path;
-    parse_url(url, type, host, path);
+    Impl impl{*this};
+    impl.parse_url(url, type, host, path);
 
 
     //construct request object
     http::request<http::empty_body> request(http::verb::get, path, 11);
 
     //insert headers
-    request.set(http::field::host, host);
-    for(auto &pair : headers){
-        request.insert(pair.first, pair.second);
-    }
+    request.set(http::field::host, type == "unix" ? "localhost" : host);
+    headers.apply(request);
 
 
-    return execute_request<http::empty_body>(type, host, request);
+    return impl.execute_request<http::empty_body>(type, host, request);
 }
 
 
@@ -248,35 +1018,77 @@ Make a Http POST request.
 @param headers: Http request headers if any
 @returns response body
 */
-auto 
+HTTP_CLIENT_DECL std::string
 HttpClient::post(
     std::string url, 
     const char *body, 
-    const std::map<std::string, std::string> &headers = {}
+    const Headers &headers
 ){   
 
     //parse the url
     std::string host;
     std::string type;
     std::string path;
-    parse_url(url, type, host, path);
+    Impl impl{*this};
+    impl.parse_url(url, type, host, path);
 
 
     //construct request object
     http::request<http::string_body> request(http::verb::post, path, 11);
 
     //insert headers
-    request.set(http::field::host, host);
-    for(auto &pair : headers){
-        request.insert(pair.first, pair.second);
-    }
+    request.set(http::field::host, type == "unix" ? "localhost" : host);
+    headers.apply(request);
 
     //insert request body
     request.body() = body;
     request.prepare_payload();
     request.set(http::field::content_length, boost::lexical_cast<std::string>(strlen(body)));
     
-    return execute_request<http::string_body>(type, host, request);
+    return impl.execute_request<http::string_body>(type, host, request);
+}
+
+
+/*
+Make a Http POST request with the contents of a file as the body. On
+plain connections, unix sockets and kTLS offloaded HTTPS connections the
+file goes out with sendfile instead of being copied through user space.
+@param url: The URL for the request
+@param file: Path of the file to send
+@param headers: Http request headers if any
+@returns response body
+*/
+HTTP_CLIENT_DECL std::string
+HttpClient::post_file(
+    std::string url, 
+    const std::string& file, 
+    const Headers &headers
+){   
+
+    //parse the url
+    std::string host;
+    std::string type;
+    std::string path;
+    Impl impl{*this};
+    impl.parse_url(url, type, host, path);
+
+
+    //construct request object
+    http::request<http::file_body> request(http::verb::post, path, 11);
+
+    //insert headers
+    request.set(http::field::host, type == "unix" ? "localhost" : host);
+    headers.apply(request);
+
+    //open the request body
+    beast::error_code ec;
+    request.body().open(file.c_str(), beast::file_mode::scan, ec);
+    if(ec){
+        throw beast::system_error{ec};
+    }
+    request.prepare_payload();
+    
+    return impl.execute_request<http::file_body>(type, host, request);
 }
 
 
@@ -287,34 +1099,33 @@ Make a Http PUT request.
 @param headers: Http request headers if any
 @returns response body
 */
-auto 
+HTTP_CLIENT_DECL std::string
 HttpClient::put(
     std::string url, 
     const char *body, 
-    const std::map<std::string, std::string> &headers = {}
+    const Headers &headers
 ){   
     //parse the url
     std::string host;
     std::string type;
     std::string path;
-    parse_url(url, type, host, path);
+    Impl impl{*this};
+    impl.parse_url(url, type, host, path);
 
 
     //construct request object
     http::request<http::string_body> request(http::verb::put, path, 11);
 
     //insert headers
-    request.set(http::field::host, host);
-    for(auto &pair : headers){
-        request.insert(pair.first, pair.second);
-    }
+    request.set(http::field::host, type == "unix" ? "localhost" : host);
+    headers.apply(request);
 
     //insert request body
     request.body() = body;
     request.prepare_payload();
     request.set(http::field::content_length, boost::lexical_cast<std::string>(strlen(body)));
     
-    return execute_request<http::string_body>(type, host, request);
+    return impl.execute_request<http::string_body>(type, host, request);
 }
 
 
@@ -324,28 +1135,75 @@ Make a Http DELETE request.
 @param headers: Http request headers if any
 @returns response body
 */
-auto 
+HTTP_CLIENT_DECL std::string
 HttpClient::delete_(
     std::string url, 
-    const std::map<std::string, std::string> &headers = {}
+    const Headers &headers
 ){
 
     //parse the url
     std::string host;
     std::string type;
     std::string path;
-    parse_url(url, type, host, path);
+    Impl impl{*this};
+    impl.parse_url(url, type, host, path);
 
 
     //construct request object
     http::request<http::empty_body> request(http::verb::delete_, path, 11);
 
     //insert headers
-    request.set(http::field::host, host);
-    for(auto &pair : headers){
-        request.insert(pair.first, pair.second);
-    }
+    request.set(http::field::host, type == "unix" ? "localhost" : host);
+    headers.apply(request);
 
-    return execute_request<http::empty_body>(type, host, request);    
+    return impl.execute_request<http::empty_body>(type, host, request);    
 }
-#endif //HTTP_HPP
\ No newline at end of file
+
+/*
+Download a resource into a file. When the server serves byte ranges the
+resource is split into ranges that are fetched in parallel over pooled
+connections, each read straight into its region of the memory mapped
+output file. A range that fails resumes from the last byte received.
+@param url: The URL for the request
+@param file: Path of the output file, replaced if it exists
+@param options: Parallelism, chunk size, retries and progress callback
+@param headers: Http request headers if any
+@returns number of bytes written
+*/
+HTTP_CLIENT_DECL std::uint64_t
+HttpClient::download(
+    std::string url, 
+    const std::string& file, 
+    const DownloadOptions& options, 
+    const Headers &headers
+){
+    //parse the url
+    std::string host;
+    std::string type;
+    std::string path;
+    Impl impl{*this};
+    impl.parse_url(url, type, host, path);
+
+
+    //construct request object
+    http::request<http::empty_body> request(http::verb::get, path, 11);
+
+    //insert headers
+    request.set(http::field::host, type == "unix" ? "localhost" : host);
+    headers.apply(request);
+
+    if(type == "https"){
+        return impl.download_from<SslStream>(type, host, request, file, options);
+    }else if(type == "http"){
+        return impl.download_from<PlainStream>(type, host, request, file, options);
+    }else if(type == "unix"){
+        return impl.download_from<UnixStream>(type, host, request, file, options);
+    }else{
+        std::cout << "ONLY HTTP/HTTPS/UNIX SUPPORTED! \n";
+        std::terminate();
+    }
+}
+
+#endif // separate compilation
+
+#endif //HTTP_HPP
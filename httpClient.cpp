@@ -0,0 +1,20 @@
+// The client compiled once, for builds with HTTP_CLIENT_SEPARATE_COMPILATION.
+// Everything else includes httpClient.hpp and links this, see CMakeLists.txt.
+#define HTTP_CLIENT_SOURCE
+
+//include the sync client
+#include "http.hpp"
+//include the async client
+#include "httpasync.hpp"
+
+#if !defined(HTTP_CLIENT_SEPARATE_COMPILATION)
+#error "httpClient.cpp is only built with HTTP_CLIENT_SEPARATE_COMPILATION, header-only builds define the client where it is included"
+#endif
+
+//the bodies AsyncHttpClient sends, declared extern in httpasync.hpp
+template RequestHandle execute_request<http::empty_body>(
+    ClientContext&, const std::string, const std::string, const http::request<http::empty_body>,
+    ResponseHandler, int);
+template RequestHandle execute_request<http::string_body>(
+    ClientContext&, const std::string, const std::string, const http::request<http::string_body>,
+    ResponseHandler, int);
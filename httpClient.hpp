@@ -0,0 +1,79 @@
+#ifndef HTTP_CLIENT_HPP
+#define HTTP_CLIENT_HPP
+//include build options
+#include "httpConfig.hpp"
+//include request headers
+#include "headers.hpp"
+//include request handles
+#include "requestHandle.hpp"
+//include responses handed over in place
+#include "jsonResponse.hpp"
+//include download options
+#include "download.hpp"
+//include others
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+// The client API on its own. http.hpp and httpasync.hpp define it on top
+// of asio, beast and OpenSSL; this header declares it without them. With
+// HTTP_CLIENT_SEPARATE_COMPILATION, include this and link the compiled
+// library (CMake target http_client) instead of compiling the client in
+// every translation unit. Contexts are configured through
+// clientContext.hpp, which still needs asio.
+
+class ClientContext;
+class ShardedClientContext;
+
+class HttpClient {
+    private:
+        //requests are made of the definitions in http.hpp
+        struct Impl;
+        std::shared_ptr<ClientContext> context_;
+        std::shared_ptr<ShardedClientContext> shards_;
+
+    public:
+        //the client only holds the shared context, all connection state lives there
+        HttpClient();
+        HttpClient(std::shared_ptr<ClientContext> context);
+        //requests run on the calling thread's shard
+        HttpClient(std::shared_ptr<ShardedClientContext> shards);
+        std::string get(std::string url, const Headers &headers = {});
+        std::string post(std::string url, const char *body, const Headers &headers = {});
+        std::string delete_(std::string url, const Headers &headers = {});
+        std::string put(std::string url, const char *body, const Headers &headers = {});
+        std::string post_file(std::string url, const std::string& file, const Headers &headers = {});
+        std::uint64_t download(std::string url, const std::string& file, const DownloadOptions& options = {}, const Headers &headers = {});
+};
+
+class AsyncHttpClient {
+
+    private:
+        //requests are made of the definitions in httpasync.hpp
+        struct Impl;
+        //the request get/post/put/delete_ built, carried by the value they return
+        struct Request;
+        std::shared_ptr<const Request> request_;
+        std::shared_ptr<ClientContext> context_;
+        std::shared_ptr<ShardedClientContext> shards_;
+        int priority_ = 0;
+
+    public:
+        AsyncHttpClient();
+        AsyncHttpClient(std::shared_ptr<ClientContext> context);
+        //requests run on the calling thread's shard
+        AsyncHttpClient(std::shared_ptr<ShardedClientContext> shards);
+        AsyncHttpClient get(std::string url, const Headers &headers = {});
+        AsyncHttpClient post(std::string url, const char* body, const Headers &headers = {});
+        AsyncHttpClient put(std::string url, const char* body, const Headers &headers = {});
+        AsyncHttpClient delete_(std::string url, const Headers &headers = {});
+        AsyncHttpClient priority(int priority);
+        RequestHandle preconnect(std::string url, std::size_t connections);
+        void keep_warm(std::string url, std::size_t connections);
+        RequestHandle then(const std::function<void(std::string)>& lamda);
+        RequestHandle then_json(const std::function<void(JsonResponse&)>& lamda);
+
+};
+
+#endif // HTTP_CLIENT_HPP
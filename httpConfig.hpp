@@ -0,0 +1,72 @@
+#ifndef HTTP_CONFIG_HPP
+#define HTTP_CONFIG_HPP
+// Build options for the client. Every header includes this first so the
+// options are seen before asio is. Define them on the compiler command
+// line and identically for every translation unit, since they change
+// asio's internals.
+//
+// HTTP_CLIENT_IO_URING
+//   Run socket I/O on asio's io_uring backend instead of epoll. Needs
+//   Linux, Boost 1.78 or newer and liburing (link with -luring). asio
+//   submits each operation on its own and doesn't register buffers, so
+//   neither batching nor registered buffers come with it; the gain is
+//   only in what the backend saves over epoll. tools/io_bench.cpp
+//   measures it against an epoll build.
+//
+// HTTP_CLIENT_SEPARATE_COMPILATION
+//   The client is compiled once into a library, httpClient.cpp (CMake
+//   target http_client), instead of in every translation unit that
+//   includes it. Include httpClient.hpp and link the library; http.hpp
+//   and httpasync.hpp then only declare what the library defines.
+//
+// HTTP_CLIENT_SIMDJSON
+//   JsonResponse::document() parses response bodies in place with
+//   simdjson's on demand API. Needs simdjson.h on the include path and
+//   simdjson linked (-lsimdjson).
+
+#include <boost/version.hpp>
+
+#if defined(HTTP_CLIENT_IO_URING)
+#  if !defined(__linux__)
+#    error "HTTP_CLIENT_IO_URING is only available on Linux"
+#  endif
+#  if BOOST_VERSION < 107800
+#    error "HTTP_CLIENT_IO_URING needs Boost 1.78 or newer, older asio has no io_uring backend"
+#  endif
+#  ifndef BOOST_ASIO_HAS_IO_URING
+#    define BOOST_ASIO_HAS_IO_URING 1
+#  endif
+// without epoll asio routes sockets through io_uring as well as files
+#  ifndef BOOST_ASIO_DISABLE_EPOLL
+#    define BOOST_ASIO_DISABLE_EPOLL 1
+#  endif
+#endif
+
+#if defined(HTTP_CLIENT_SIMDJSON) && defined(__has_include)
+#  if !__has_include(<simdjson.h>)
+#    error "HTTP_CLIENT_SIMDJSON needs simdjson.h on the include path"
+#  endif
+#endif
+
+// HTTP_CLIENT_SOURCE is defined by httpClient.cpp, the one translation
+// unit that compiles the client's definitions in separate compilation
+#if defined(HTTP_CLIENT_SEPARATE_COMPILATION)
+#  define HTTP_CLIENT_DECL
+#else
+#  define HTTP_CLIENT_DECL inline
+#endif
+
+// Name of the reactor the client's loop runs on
+inline const char*
+http_client_io_backend()
+{
+#if defined(HTTP_CLIENT_IO_URING)
+    return "io_uring";
+#elif defined(__linux__)
+    return "epoll";
+#else
+    return "default";
+#endif
+}
+
+#endif // HTTP_CONFIG_HPP
@@ -1,17 +1,28 @@
 #ifndef HTTP_ASYNC_HPP
 #define HTTP_ASYNC_HPP
+//include build options
+#include "httpConfig.hpp"
+//include the client's declaration
+#include "httpClient.hpp"
 //include certify for ssl
 #include <boost/certify/extensions.hpp>
 #include <boost/certify/https_verification.hpp>
 //include session clients
 #include "asyncSslSession.hpp"
 #include "asyncSession.hpp"
+#include "asyncUnixSession.hpp"
+//include thread-per-core mode
+#include "shardedClientContext.hpp"
+//include request headers
+#include "headers.hpp"
 //include other
 #include <boost/lexical_cast.hpp>
 #include <iostream>
+#include <mutex>
+#include <stdexcept>
 #include <string>
-#include <map>
-#include <thread>
+#include <variant>
+#include <vector>
 
 namespace beast = boost::beast;
 namespace http = beast::http;
@@ -20,65 +31,241 @@ namespace ssl = boost::asio::ssl;
 using tcp = boost::asio::ip::tcp;
 
 template<class requestType>
-void execute_request(
+RequestHandle execute_request(
+    ClientContext& context,
     const std::string type, 
     const std::string host, 
     const http::request<requestType> request, 
-    std::function<void(std::string)> callback
+    ResponseHandler callback,
+    int priority = 0
 ){
-    //create io context
-    asio::io_context io;
+    if(auto recorder = context.recorder())
+        recorder->record(type, host, request);
 
-    if(type == "https"){
+    auto state = std::make_shared<RequestState>();
+    std::function<void()> start;
 
-        //create ssl context
-        ssl::context ssl{ssl::context::tls_client};
-        ssl.set_verify_mode(ssl::context::verify_peer | ssl::context::verify_fail_if_no_peer_cert);
-        ssl.set_default_verify_paths();
-        boost::certify::enable_native_https_server_verification(ssl);
+    if(type == "https"){
 
-        //create a async ssl session and run the io 
-        std::make_shared<AsyncSslSession>(asio::make_strand(io), ssl)->run(host.c_str(), "https", request, callback);
-        io.run();
+        //create a async ssl session on the shared loop
+        auto session = std::make_shared<AsyncSslSession>(context);
+        start = [session, host, request, callback, state]{
+            session->run(host.c_str(), "https", request, callback, state);
+        };
 
     }else if(type == "http"){
 
-        //create a async  session and run the io 
-        std::make_shared<AsyncSession>(io)->run(host.c_str(), "http", request, callback);
-        io.run();
+        //create a async session on the shared loop
+        auto session = std::make_shared<AsyncSession>(context);
+        start = [session, host, request, callback, state]{
+            session->run(host.c_str(), "http", request, callback, state);
+        };
         
+    }else if(type == "unix"){
+
+        //create a async unix socket session on the shared loop
+        auto session = std::make_shared<AsyncUnixSession>(context);
+        start = [session, host, request, callback, state]{
+            session->run(host.c_str(), request, callback, state);
+        };
+
     }else{
-        std::cout << "ONLY HTTP/HTTPS SUPPORTED! \n";
+        std::cout << "ONLY HTTP/HTTPS/UNIX SUPPORTED! \n";
         std::terminate();
     }
 
+    //hand the request to the loop, which starts it now or once the
+    //host's rate and concurrency limits allow it
+    context.submit([&context, host, priority, state, start]{
+        context.governor().submit(host, priority, state, start, [state](beast::error_code ec){
+            if(state->cancelled()){
+                ec = asio::error::operation_aborted;
+            }else{
+                fail(ec, "admission");
+            }
+            state->complete(ec);
+        });
+    });
+
+    return RequestHandle(state);
+}
+
+//hand the callback the body as a string
+template<class requestType>
+RequestHandle execute_request(
+    ClientContext& context,
+    const std::string type, 
+    const std::string host, 
+    const http::request<requestType> request, 
+    std::function<void(std::string)> callback,
+    int priority = 0
+){
+    return execute_request(context, type, host, request, ResponseHandler([callback](http::response<padded_body>& response){
+        callback(response.body().str());
+    }), priority);
+}
+
+//hand the callback the body where it was read into, see JsonResponse
+template<class requestType>
+RequestHandle execute_request(
+    ClientContext& context,
+    const std::string type, 
+    const std::string host, 
+    const http::request<requestType> request, 
+    std::function<void(JsonResponse&)> callback,
+    int priority = 0
+){
+    return execute_request(context, type, host, request, ResponseHandler([callback](http::response<padded_body>& response){
+        auto& body = response.body();
+        JsonResponse json(body.data(), body.size(), PaddedBuffer::padding, response.result_int());
+        callback(json);
+    }), priority);
+}
+
+//with separate compilation the bodies AsyncHttpClient sends are
+//instantiated once, in httpClient.cpp
+#if defined(HTTP_CLIENT_SEPARATE_COMPILATION) && !defined(HTTP_CLIENT_SOURCE)
+extern template RequestHandle execute_request<http::empty_body>(
+    ClientContext&, const std::string, const std::string, const http::request<http::empty_body>,
+    ResponseHandler, int);
+extern template RequestHandle execute_request<http::string_body>(
+    ClientContext&, const std::string, const std::string, const http::request<http::string_body>,
+    ResponseHandler, int);
+#endif
+
+//open one connection for host and park it in the pool
+inline void
+open_warm(
+    ClientContext& context,
+    const std::string& type,
+    const std::string& host,
+    std::shared_ptr<RequestState> state
+){
+    if(type == "https"){
+        std::make_shared<AsyncSslSession>(context)->warm(host.c_str(), "https", state);
+    }else if(type == "http"){
+        std::make_shared<AsyncSession>(context)->warm(host.c_str(), "http", state);
+    }else if(type == "unix"){
+        std::make_shared<AsyncUnixSession>(context)->warm(host.c_str(), state);
+    }else{
+        std::cout << "ONLY HTTP/HTTPS/UNIX SUPPORTED! \n";
+        std::terminate();
+    }
 }
 
-class AsyncHttpClient {
+inline RequestHandle
+preconnect(
+    ClientContext& context,
+    const std::string& type,
+    const std::string& host,
+    std::size_t connections
+){
+    //one handle for all the connections, done when the last one is
+    struct Progress {
+        std::mutex mutex;
+        std::size_t left;
+        beast::error_code error;
+    };
+    auto all = std::make_shared<RequestState>();
+    auto progress = std::make_shared<Progress>();
+    progress->left = connections;
+    if(connections == 0){
+        all->complete({});
+        return RequestHandle(all);
+    }
 
-    private:
-        template<class requestType>
-        static http::request<requestType> request_;
-        std::string request_type_;
-        std::string host_;
-        std::string type_;
-        auto parse_url(std::string& url, std::string& type, std::string& host, std::string& path);
+    std::vector<std::shared_ptr<RequestState>> states;
+    for(std::size_t i = 0; i < connections; ++i){
+        auto state = std::make_shared<RequestState>();
+        auto raw = state.get();
+        state->on_finish([all, progress, raw]{
+            beast::error_code error;
+            {
+                std::lock_guard<std::mutex> lock(progress->mutex);
+                if(raw->error() && !progress->error)
+                    progress->error = raw->error();
+                if(--progress->left > 0)
+                    return;
+                error = progress->error;
+            }
+            all->complete(error);
+        });
+        states.push_back(state);
+    }
+    all->on_cancel([states]{
+        for(auto& state : states){
+            state->cancel();
+        }
+    });
+
+    //warm-ups aren't requests, they skip the governor
+    context.submit([&context, type, host, states]{
+        for(auto& state : states){
+            open_warm(context, type, host, state);
+        }
+    });
+
+    return RequestHandle(all);
+}
 
-    public:
-        AsyncHttpClient(){}
-        auto get(std::string url, const std::map<std::string, std::string> &headers);
-        auto post(std::string url, const char* body, const std::map<std::string, std::string> &headers);
-        auto put(std::string url, const char* body, const std::map<std::string, std::string> &headers);
-        auto delete_(std::string url, const std::map<std::string, std::string> &headers);
-        void then(const std::function<void(std::string)>& lamda);
+inline void
+keep_warm(
+    ClientContext& context,
+    const std::string& type,
+    const std::string& host,
+    std::size_t connections
+){
+    context.keep_warm(type + "://" + host, connections, [&context, type, host](std::function<void()> done){
+        auto state = std::make_shared<RequestState>();
+        state->on_finish(done);
+        open_warm(context, type, host, state);
+    });
+}
 
+//with separate compilation only httpClient.cpp defines the client
+#if !defined(HTTP_CLIENT_SEPARATE_COMPILATION) || defined(HTTP_CLIENT_SOURCE)
+
+// What AsyncHttpClient's requests are made of, kept out of httpClient.hpp
+// so the public header needs neither asio nor beast
+struct AsyncHttpClient::Impl {
+    AsyncHttpClient& client_;
+    ClientContext& context(){ return client_.shards_ ? client_.shards_->local() : *client_.context_; }
+    auto parse_url(std::string& url, std::string& type, std::string& host, std::string& path);
+    template<class Callback>
+    RequestHandle execute(const Callback& callback);
 };
 
-template<class requestType>
-http::request<requestType> AsyncHttpClient::request_;
+struct AsyncHttpClient::Request {
+    std::string type;
+    std::string host;
+    std::variant<http::request<http::empty_body>, http::request<http::string_body>> message;
+};
+
+HTTP_CLIENT_DECL
+AsyncHttpClient::AsyncHttpClient()
+    : context_(ClientContext::shared()){}
+
+HTTP_CLIENT_DECL
+AsyncHttpClient::AsyncHttpClient(std::shared_ptr<ClientContext> context)
+    : context_(std::move(context)){}
+
+HTTP_CLIENT_DECL
+AsyncHttpClient::AsyncHttpClient(std::shared_ptr<ShardedClientContext> shards)
+    : shards_(std::move(shards)){}
+
+template<class Callback>
+RequestHandle
+AsyncHttpClient::Impl::execute(const Callback& callback){
+    if(!client_.request_)
+        throw std::logic_error("then() needs a request, call get(), post(), put() or delete_() first");
+    auto& request = *client_.request_;
+    return std::visit([&](const auto& message){
+        return execute_request(context(), request.type, request.host, message, callback, client_.priority_);
+    }, request.message);
+}
 
-auto 
-AsyncHttpClient::parse_url(
+inline auto 
+AsyncHttpClient::Impl::parse_url(
     std::string& url, 
     std::string& type, 
     std::string& host, 
@@ -89,6 +276,15 @@ AsyncHttpClient::parse_url(
     type = url.substr(0, column_index);
 
     url = url.substr(column_index + 3);
+
+    //unix:///path/to.sock:/request/path, the socket path stands in for the host
+    if(type == "unix"){
+        auto path_index = url.find(':');
+        host = url.substr(0, path_index);
+        path = path_index == std::string::npos ? "/" : url.substr(path_index + 1);
+        return;
+    }
+
     try{
         unsigned short slash_index =  url.find('/');
         host = url.substr(0, slash_index);
@@ -106,33 +302,30 @@ Make a Http GET request.
 @returns the client instance. You should call the .then() 
 to provide the callback to be invoked when the response recieved.
 */
-auto 
+HTTP_CLIENT_DECL AsyncHttpClient
 AsyncHttpClient::get(
     std::string url, 
-    const std::map<std::string, std::string> &headers = {}
+    const Headers &headers
 ){
 
     //parse the url
     std::string host;
     std::string type;
     std::string path;
-    parse_url(url, type, host, path);
+    Impl impl{*this};
+    impl.parse_url(url, type, host, path);
 
     //create a get request
     http::request<http::empty_body> request(http::verb::get, path, 11);
 
     //insert headers
-    request.set(http::field::host, host);
-    for(auto &pair : headers){
-        request.insert(pair.first, pair.second);
-    }
+    request.set(http::field::host, type == "unix" ? "localhost" : host);
+    headers.apply(request);
 
-    //save varibles to be used at .then()
-    request_type_ = "empty";
-    request_<http::empty_body> = request;
-    type_ = type;
-    host_ = host;
-    return *this;
+    //the returned value carries the request to .then(), this client is left as it was
+    AsyncHttpClient call(*this);
+    call.request_ = std::make_shared<Request>(Request{type, host, std::move(request)});
+    return call;
 }
 
 
@@ -144,39 +337,36 @@ Make a Http POST request.
 @returns the client instance. You should call the .then() 
 to provide the callback to be invoked when the response recieved.
 */
-auto 
+HTTP_CLIENT_DECL AsyncHttpClient
 AsyncHttpClient::post(
     std::string url,
     const char* body,
-    const std::map<std::string, std::string> &headers = {}
+    const Headers &headers
 ){
 
     //parse the url
     std::string host;
     std::string type;
     std::string path;
-    parse_url(url, type, host, path);
+    Impl impl{*this};
+    impl.parse_url(url, type, host, path);
 
     //create a get request
     http::request<http::string_body> request(http::verb::post, path, 11);
 
     //insert headers
-    request.set(http::field::host, host);
-    for(auto &pair : headers){
-        request.insert(pair.first, pair.second);
-    }
+    request.set(http::field::host, type == "unix" ? "localhost" : host);
+    headers.apply(request);
 
     //insert request body
     request.body() = body;
     request.prepare_payload();
     request.set(http::field::content_length, boost::lexical_cast<std::string>(strlen(body)));
 
-    //save varibles to be used at .then()
-    request_type_ = "loaded";
-    request_<http::string_body> = request;
-    type_ = type;
-    host_ = host;
-    return *this;
+    //the returned value carries the request to .then(), this client is left as it was
+    AsyncHttpClient call(*this);
+    call.request_ = std::make_shared<Request>(Request{type, host, std::move(request)});
+    return call;
 }
 
 
@@ -188,27 +378,26 @@ Make a Http PUT request.
 @returns the client instance. You should call the .then() 
 to provide the callback to be invoked when the response recieved.
 */
-auto 
+HTTP_CLIENT_DECL AsyncHttpClient
 AsyncHttpClient::put(
     std::string url,
     const char* body,
-    const std::map<std::string, std::string> &headers = {}
+    const Headers &headers
 ){
 
     //parse the url
     std::string host;
     std::string type;
     std::string path;
-    parse_url(url, type, host, path);
+    Impl impl{*this};
+    impl.parse_url(url, type, host, path);
 
     //create a get request
     http::request<http::string_body> request(http::verb::put, path, 11);
 
     //insert headers
-    request.set(http::field::host, host);
-    for(auto &pair : headers){
-        request.insert(pair.first, pair.second);
-    }
+    request.set(http::field::host, type == "unix" ? "localhost" : host);
+    headers.apply(request);
 
 
     //insert request body
@@ -216,12 +405,10 @@ AsyncHttpClient::put(
     request.prepare_payload();
     request.set(http::field::content_length, boost::lexical_cast<std::string>(strlen(body)));
 
-    //save varibles to be used at .then()
-    request_type_ = "loaded";
-    request_<http::string_body> = request;
-    type_ = type;
-    host_ = host;
-    return *this;
+    //the returned value carries the request to .then(), this client is left as it was
+    AsyncHttpClient call(*this);
+    call.request_ = std::make_shared<Request>(Request{type, host, std::move(request)});
+    return call;
 }
 
 
@@ -232,32 +419,40 @@ Make a Http DELETE request.
 @returns the client instance. You should call the .then() 
 to provide the callback to be invoked when the response recieved.
 */
-auto 
+HTTP_CLIENT_DECL AsyncHttpClient
 AsyncHttpClient::delete_(
     std::string url, 
-    const std::map<std::string, std::string> &headers = {}
+    const Headers &headers
 ){
 
     //parse the url
     std::string host;
     std::string type;
     std::string path;
-    parse_url(url, type, host, path);
+    Impl impl{*this};
+    impl.parse_url(url, type, host, path);
 
     //create a get request
     http::request<http::empty_body> request(http::verb::delete_, path, 11);
 
     //insert headers
-    request.set(http::field::host, host);
-    for(auto &pair : headers){
-        request.insert(pair.first, pair.second);
-    }
+    request.set(http::field::host, type == "unix" ? "localhost" : host);
+    headers.apply(request);
 
-    //save varibles to be used at .then()
-    request_type_ = "empty";
-    request_<http::empty_body> = request;
-    type_ = type;
-    host_ = host;
+    //the returned value carries the request to .then(), this client is left as it was
+    AsyncHttpClient call(*this);
+    call.request_ = std::make_shared<Request>(Request{type, host, std::move(request)});
+    return call;
+}
+
+/*
+Set the priority used when the host's limits queue the request.
+@param priority: larger values are admitted first, default 0
+@returns the client instance.
+*/
+HTTP_CLIENT_DECL AsyncHttpClient
+AsyncHttpClient::priority(int priority){
+    priority_ = priority;
     return *this;
 }
 
@@ -266,28 +461,76 @@ Function to be called to provide the callback function
 that will be invoked when the response received.
 @param callback: callback to be invoked when the response
 received.
+@returns a handle to wait for or cancel the request. The
+callback is not invoked for a cancelled request.
 */
-void
+HTTP_CLIENT_DECL RequestHandle
 AsyncHttpClient::then(const std::function<void(std::string)>& callback){
-    if(request_type_ == "empty"){
-        std::thread(
-            execute_request<http::empty_body>, 
-            type_, 
-            host_, 
-            request_<http::empty_body>,
-            callback
-        ).detach();
-    }
+    Impl impl{*this};
+    return impl.execute(callback);
+}
 
-    if(request_type_ == "loaded"){
-        std::thread(
-            execute_request<http::string_body>, 
-            type_, 
-            host_, 
-            request_<http::string_body>, 
-            callback
-        ).detach();
-    }
+/*
+Like .then(), but the callback gets the response body where it was read
+into instead of a copy. It is followed by padding for SIMD parsers, and
+with HTTP_CLIENT_SIMDJSON JsonResponse::document() parses it in place.
+The body is only valid during the callback, its buffer is recycled for
+later responses.
+@param callback: callback to be invoked when the response
+received.
+@returns a handle to wait for or cancel the request. The
+callback is not invoked for a cancelled request.
+*/
+HTTP_CLIENT_DECL RequestHandle
+AsyncHttpClient::then_json(const std::function<void(JsonResponse&)>& callback){
+    Impl impl{*this};
+    return impl.execute(callback);
+}
+/*
+Open connections to the url's host ahead of time, resolving, connecting
+and completing the TLS handshake, and park them in the pool so the first
+requests skip the setup. Sync requests on the same context use them too.
+@param url: The URL of the host to connect to, the path is ignored
+@param connections: number of connections to open
+@returns a handle that is done once every connection is open or failed
+*/
+HTTP_CLIENT_DECL RequestHandle
+AsyncHttpClient::preconnect(std::string url, std::size_t connections){
+    std::string host;
+    std::string type;
+    std::string path;
+    Impl impl{*this};
+    impl.parse_url(url, type, host, path);
+
+    return ::preconnect(impl.context(), type, host, connections);
+}
 
+/*
+Keep at least the given number of idle connections to the url's host
+pooled. Idle connections are replaced with fresh ones before the pool's
+idle timeout would drop them, and ones taken by requests are replaced
+within a few seconds.
+@param url: The URL of the host to connect to, the path is ignored
+@param connections: the floor, capped at the pool's per host limit; 0 removes it
+*/
+HTTP_CLIENT_DECL void
+AsyncHttpClient::keep_warm(std::string url, std::size_t connections){
+    std::string host;
+    std::string type;
+    std::string path;
+    Impl impl{*this};
+    impl.parse_url(url, type, host, path);
+
+    //every shard keeps its own floor, requests may land on any of them
+    if(shards_){
+        shards_->for_each([&](ClientContext& shard){
+            ::keep_warm(shard, type, host, connections);
+        });
+        return;
+    }
+    ::keep_warm(*context_, type, host, connections);
 }
-#endif // HTTP_ASYNC_HPP
\ No newline at end of file
+
+#endif // separate compilation
+
+#endif // HTTP_ASYNC_HPP
@@ -0,0 +1,58 @@
+#ifndef JSON_RESPONSE_HPP
+#define JSON_RESPONSE_HPP
+//include build options
+#include "httpConfig.hpp"
+//include beast
+#include <boost/beast/core/string.hpp>
+//include simdjson if opted in
+#if defined(HTTP_CLIENT_SIMDJSON)
+#include <simdjson.h>
+#endif
+//include others
+#include <cstddef>
+#include <string>
+
+namespace beast = boost::beast;
+
+// A response handed to AsyncHttpClient::then_json. The body is not
+// copied out of the buffer it was read into, and padding() readable
+// bytes follow it, so a SIMD parser can parse it in place. Both are only
+// valid during the callback, the buffer is recycled afterwards.
+class JsonResponse
+{
+    const char* data_;
+    std::size_t size_;
+    std::size_t padding_;
+    unsigned status_;
+
+public:
+    JsonResponse(const char* data, std::size_t size, std::size_t padding, unsigned status)
+        : data_(data), size_(size), padding_(padding), status_(status)
+    {
+    }
+
+    unsigned status() const { return status_; }
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    std::size_t padding() const { return padding_; }
+
+    beast::string_view
+    body() const
+    {
+        return {data_, size_};
+    }
+
+#if defined(HTTP_CLIENT_SIMDJSON)
+    // The body as an on demand document, parsed as it is read. Each loop
+    // thread has one parser, so the document is invalidated by the next
+    // call on the same thread.
+    simdjson::simdjson_result<simdjson::ondemand::document>
+    document() const
+    {
+        thread_local simdjson::ondemand::parser parser;
+        return parser.iterate(data_, size_, size_ + padding_);
+    }
+#endif
+};
+
+#endif // JSON_RESPONSE_HPP
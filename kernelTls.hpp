@@ -0,0 +1,321 @@
+#ifndef KERNEL_TLS_HPP
+#define KERNEL_TLS_HPP
+//include build options
+#include "httpConfig.hpp"
+//include beast
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/ssl.hpp>
+//include stream types
+#include "connectionPool.hpp"
+//include openssl for the traffic secrets
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/ssl.h>
+//include others
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#if __has_include(<linux/tls.h>)
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#define HTTP_CLIENT_HAS_KTLS 1
+#endif
+#endif
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace asio = boost::asio;
+
+// Kernel TLS transmit offload. After a TLS 1.3 handshake with an AES-GCM
+// or ChaCha20-Poly1305 suite, the client's traffic key is handed to the
+// kernel, which then encrypts everything written to the socket. Requests
+// are written to the TCP stream directly, skipping OpenSSL and its
+// buffers, and files can go out with sendfile. Responses are still read
+// and decrypted by OpenSSL. A stream that can't be offloaded, because of
+// the kernel, the protocol version or the cipher, stays as it was.
+//
+// OpenSSL only exposes the traffic secret through the key log callback,
+// so ktls_prepare() must be installed on the context before handshakes.
+// Once offloaded, OpenSSL must never write on the connection again: no
+// close_notify is sent, and a server requesting a key update would break
+// the connection.
+
+struct KtlsState {
+    std::vector<unsigned char> client_secret;
+    bool tx = false;
+};
+
+inline int
+ktls_index()
+{
+    static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr,
+        [](void*, void* state, CRYPTO_EX_DATA*, int, long, void*){
+            delete static_cast<KtlsState*>(state);
+        });
+    return index;
+}
+
+inline KtlsState*
+ktls_state(const SSL* ssl)
+{
+    return static_cast<KtlsState*>(SSL_get_ex_data(ssl, ktls_index()));
+}
+
+// Keeps CLIENT_TRAFFIC_SECRET_0 of each connection, nothing is logged
+inline void
+ktls_keylog(const SSL* ssl, const char* line)
+{
+    static const char label[] = "CLIENT_TRAFFIC_SECRET_0 ";
+    if(std::strncmp(line, label, sizeof(label) - 1) != 0)
+        return;
+
+    // the line ends with the secret in hex
+    auto hex = std::strrchr(line, ' ') + 1;
+    std::vector<unsigned char> secret;
+    for(; hex[0] && hex[1]; hex += 2){
+        char byte[3] = {hex[0], hex[1], 0};
+        secret.push_back(static_cast<unsigned char>(std::strtoul(byte, nullptr, 16)));
+    }
+
+    auto state = ktls_state(ssl);
+    if(!state){
+        state = new KtlsState;
+        SSL_set_ex_data(const_cast<SSL*>(ssl), ktls_index(), state);
+    }
+    state->client_secret = std::move(secret);
+}
+
+inline void
+ktls_prepare(asio::ssl::context& context)
+{
+    SSL_CTX_set_keylog_callback(context.native_handle(), ktls_keylog);
+}
+
+// HKDF-Expand-Label from RFC 8446 with an empty context
+inline bool
+hkdf_expand_label(
+    const EVP_MD* md,
+    const std::vector<unsigned char>& secret,
+    const char* label,
+    unsigned char* out,
+    std::size_t length
+){
+    std::string full = std::string("tls13 ") + label;
+    std::vector<unsigned char> info;
+    info.push_back(static_cast<unsigned char>(length >> 8));
+    info.push_back(static_cast<unsigned char>(length));
+    info.push_back(static_cast<unsigned char>(full.size()));
+    info.insert(info.end(), full.begin(), full.end());
+    info.push_back(0);
+
+    auto ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+    bool ok = ctx
+        && EVP_PKEY_derive_init(ctx) > 0
+        && EVP_PKEY_CTX_set_hkdf_mode(ctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) > 0
+        && EVP_PKEY_CTX_set_hkdf_md(ctx, md) > 0
+        && EVP_PKEY_CTX_set1_hkdf_key(ctx, secret.data(), static_cast<int>(secret.size())) > 0
+        && EVP_PKEY_CTX_add1_hkdf_info(ctx, info.data(), static_cast<int>(info.size())) > 0
+        && EVP_PKEY_derive(ctx, out, &length) > 0;
+    EVP_PKEY_CTX_free(ctx);
+    return ok;
+}
+
+// The client's write key and IV for the connection's TLS 1.3 suite
+inline bool
+ktls_tx_keys(
+    SSL* ssl,
+    std::uint32_t& suite,
+    unsigned char* key,
+    std::size_t& key_length,
+    unsigned char* iv
+){
+    auto state = ktls_state(ssl);
+    if(!state || state->client_secret.empty() || SSL_version(ssl) != TLS1_3_VERSION)
+        return false;
+
+    const EVP_MD* md;
+    suite = SSL_CIPHER_get_id(SSL_get_current_cipher(ssl));
+    switch(suite){
+    case TLS1_3_CK_AES_128_GCM_SHA256:
+        md = EVP_sha256();
+        key_length = 16;
+        break;
+    case TLS1_3_CK_AES_256_GCM_SHA384:
+        md = EVP_sha384();
+        key_length = 32;
+        break;
+    case TLS1_3_CK_CHACHA20_POLY1305_SHA256:
+        md = EVP_sha256();
+        key_length = 32;
+        break;
+    default:
+        return false;
+    }
+
+    return hkdf_expand_label(md, state->client_secret, "key", key, key_length)
+        && hkdf_expand_label(md, state->client_secret, "iv", iv, 12);
+}
+
+#if defined(HTTP_CLIENT_HAS_KTLS)
+template<class Info>
+bool
+ktls_set_tx(int fd, Info& info, int cipher, const unsigned char* key, const unsigned char* iv)
+{
+    info.info.version = TLS_1_3_VERSION;
+    info.info.cipher_type = cipher;
+    std::memcpy(info.key, key, sizeof(info.key));
+    // the salt is the part of the IV the record sequence isn't mixed into
+    std::memcpy(info.salt, iv, sizeof(info.salt));
+    std::memcpy(info.iv, iv + sizeof(info.salt), sizeof(info.iv));
+    // nothing has been sent with the traffic key yet
+    std::memset(info.rec_seq, 0, sizeof(info.rec_seq));
+
+    bool ok = ::setsockopt(fd, SOL_TLS, TLS_TX, &info, sizeof(info)) == 0;
+    OPENSSL_cleanse(&info, sizeof(info));
+    return ok;
+}
+#endif
+
+// Hand a freshly handshaken stream's encryption to the kernel. Returns
+// false, with the stream unchanged, when that isn't possible.
+inline bool
+ktls_enable_tx(SslStream& stream)
+{
+#if defined(HTTP_CLIENT_HAS_KTLS)
+    auto ssl = stream.native_handle();
+    auto state = ktls_state(ssl);
+    if(!state)
+        return false;
+
+    std::uint32_t suite;
+    unsigned char key[32];
+    std::size_t key_length;
+    unsigned char iv[12];
+    bool ok = ktls_tx_keys(ssl, suite, key, key_length, iv);
+    OPENSSL_cleanse(state->client_secret.data(), state->client_secret.size());
+    state->client_secret.clear();
+    if(!ok)
+        return false;
+
+    // no tls module means plain sockets, a failing TLS_TX leaves the
+    // socket in its pass-through mode
+    int fd = beast::get_lowest_layer(stream).socket().native_handle();
+    if(::setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) == 0){
+        if(suite == TLS1_3_CK_AES_128_GCM_SHA256){
+            tls12_crypto_info_aes_gcm_128 info{};
+            state->tx = ktls_set_tx(fd, info, TLS_CIPHER_AES_GCM_128, key, iv);
+        }else if(suite == TLS1_3_CK_AES_256_GCM_SHA384){
+            tls12_crypto_info_aes_gcm_256 info{};
+            state->tx = ktls_set_tx(fd, info, TLS_CIPHER_AES_GCM_256, key, iv);
+        }else{
+            tls12_crypto_info_chacha20_poly1305 info{};
+            state->tx = ktls_set_tx(fd, info, TLS_CIPHER_CHACHA20_POLY1305, key, iv);
+        }
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+    OPENSSL_cleanse(iv, sizeof(iv));
+    return state->tx;
+#else
+    boost::ignore_unused(stream);
+    return false;
+#endif
+}
+
+inline bool
+ktls_tx_active(SslStream& stream)
+{
+    auto state = ktls_state(stream.native_handle());
+    return state && state->tx;
+}
+
+// Stream a file onto a socket that takes plaintext, without copying
+// it through user space. The socket may be in asio's internal
+// non-blocking mode, so wait for room when the kernel has none.
+template<class Socket>
+void
+send_file(Socket& socket, int file, std::uint64_t size, beast::error_code& ec)
+{
+#if defined(__linux__)
+    off_t offset = 0;
+    while(static_cast<std::uint64_t>(offset) < size){
+        auto chunk = static_cast<std::size_t>(std::min<std::uint64_t>(size - offset, 1 << 30));
+        auto sent = ::sendfile(socket.native_handle(), file, &offset, chunk);
+        if(sent > 0)
+            continue;
+        if(sent == 0){
+            // the file shrank under us
+            ec = http::error::partial_message;
+            return;
+        }
+        if(errno == EINTR)
+            continue;
+        if(errno == EAGAIN){
+            socket.wait(Socket::wait_write, ec);
+            if(ec)
+                return;
+            continue;
+        }
+        ec = beast::error_code(errno, boost::system::system_category());
+        return;
+    }
+#else
+    boost::ignore_unused(socket, file, size);
+    ec = asio::error::operation_not_supported;
+#endif
+}
+
+// Write a request on whatever the connection encrypts with: the TCP
+// stream itself for plain and offloaded TLS connections, OpenSSL
+// otherwise. File bodies on the former go out with sendfile.
+template<class Stream, class Body>
+void
+write_request(Stream& stream, const http::request<Body>& request, beast::error_code& ec)
+{
+    http::write(stream, request, ec);
+}
+
+template<class Body>
+void
+write_request(SslStream& stream, const http::request<Body>& request, beast::error_code& ec)
+{
+    if(ktls_tx_active(stream)){
+        http::write(beast::get_lowest_layer(stream), request, ec);
+        return;
+    }
+    http::write(stream, request, ec);
+}
+
+template<class Stream>
+void
+write_request(Stream& stream, http::request<http::file_body>& request, beast::error_code& ec)
+{
+    auto& file = request.body().file();
+    file.seek(0, ec);
+    if(ec)
+        return;
+
+    http::request_serializer<http::file_body> serializer(request);
+    http::write_header(stream, serializer, ec);
+    if(ec)
+        return;
+    send_file(beast::get_lowest_layer(stream).socket(), file.native_handle(), request.body().size(), ec);
+}
+
+inline void
+write_request(SslStream& stream, http::request<http::file_body>& request, beast::error_code& ec)
+{
+    if(ktls_tx_active(stream))
+        return write_request(beast::get_lowest_layer(stream), request, ec);
+
+    // OpenSSL encrypts, the file goes through its buffers
+    request.body().file().seek(0, ec);
+    if(ec)
+        return;
+    http::write(stream, request, ec);
+}
+
+#endif // KERNEL_TLS_HPP
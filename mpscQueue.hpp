@@ -0,0 +1,71 @@
+#ifndef MPSC_QUEUE_HPP
+#define MPSC_QUEUE_HPP
+//include build options
+#include "httpConfig.hpp"
+//include others
+#include <atomic>
+#include <utility>
+
+// Unbounded lock-free multi-producer single-consumer queue (Vyukov).
+// push() is wait-free and may be called from any thread, pop() only
+// from the single consumer. A push that is still linking its node can
+// make pop() report empty for a moment; the consumer picks it up on
+// its next pass.
+template<class T>
+class MpscQueue
+{
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        T value;
+        Node() = default;
+        explicit Node(T v) : value(std::move(v)){}
+    };
+
+    // producers and the consumer touch different ends, keep them apart
+    alignas(64) std::atomic<Node*> head_;
+    alignas(64) Node* tail_;
+
+public:
+    MpscQueue()
+    {
+        auto stub = new Node;
+        head_.store(stub, std::memory_order_relaxed);
+        tail_ = stub;
+    }
+
+    ~MpscQueue()
+    {
+        T ignored;
+        while(pop(ignored)){
+        }
+        delete tail_;
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void
+    push(T value)
+    {
+        auto node = new Node(std::move(value));
+        auto prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    bool
+    pop(T& value)
+    {
+        auto tail = tail_;
+        auto next = tail->next.load(std::memory_order_acquire);
+        if(!next)
+            return false;
+
+        // next becomes the new stub once its value is taken
+        value = std::move(next->value);
+        tail_ = next;
+        delete tail;
+        return true;
+    }
+};
+
+#endif // MPSC_QUEUE_HPP
@@ -0,0 +1,279 @@
+#ifndef PADDED_BODY_HPP
+#define PADDED_BODY_HPP
+//include build options
+#include "httpConfig.hpp"
+//include beast
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/core/string.hpp>
+#include <boost/beast/http/error.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/optional.hpp>
+//include the responses handed to json callbacks
+#include "jsonResponse.hpp"
+//include others
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+// Bytes followed by padding zeroed bytes, so a SIMD parser like
+// simdjson can read the contents in place, past their end, instead of
+// copying them into a padded string of its own. Grows like a vector
+// and keeps its storage when cleared.
+class PaddedBuffer
+{
+public:
+    // simdjson's SIMDJSON_PADDING
+    static constexpr std::size_t padding = 64;
+
+private:
+    std::unique_ptr<char[]> data_;
+    std::size_t size_ = 0;
+    std::size_t capacity_ = 0;      // usable bytes, the padding comes on top
+
+    void
+    pad()
+    {
+        std::memset(data_.get() + size_, 0, padding);
+    }
+
+public:
+    PaddedBuffer() = default;
+
+    PaddedBuffer(PaddedBuffer&& other) noexcept
+        : data_(std::move(other.data_))
+        , size_(std::exchange(other.size_, 0))
+        , capacity_(std::exchange(other.capacity_, 0))
+    {
+    }
+
+    PaddedBuffer&
+    operator=(PaddedBuffer&& other) noexcept
+    {
+        data_ = std::move(other.data_);
+        size_ = std::exchange(other.size_, 0);
+        capacity_ = std::exchange(other.capacity_, 0);
+        return *this;
+    }
+
+    char* data(){ return data_.get(); }
+    const char* data() const { return data_.get(); }
+    std::size_t size() const { return size_; }
+    std::size_t capacity() const { return capacity_; }
+    bool empty() const { return size_ == 0; }
+
+    beast::string_view
+    view() const
+    {
+        return {data_.get(), size_};
+    }
+
+    std::string
+    str() const
+    {
+        return std::string(data_.get(), size_);
+    }
+
+    // Make room for capacity bytes in total, keeping the contents
+    void
+    reserve(std::size_t capacity)
+    {
+        if(data_ && capacity <= capacity_)
+            return;
+
+        std::unique_ptr<char[]> data(new char[capacity + padding]);
+        if(size_)
+            std::memcpy(data.get(), data_.get(), size_);
+        data_ = std::move(data);
+        capacity_ = capacity;
+        pad();
+    }
+
+    // Room for n more bytes after the contents, commit what was written
+    char*
+    prepare(std::size_t n)
+    {
+        if(!data_ || n > capacity_ - size_)
+            reserve(std::max(size_ + n, capacity_ + capacity_ / 2));
+        return data_.get() + size_;
+    }
+
+    void
+    commit(std::size_t n)
+    {
+        size_ += n;
+        pad();
+    }
+
+    void
+    append(const char* data, std::size_t n)
+    {
+        std::memcpy(prepare(n), data, n);
+        commit(n);
+    }
+
+    void
+    clear()
+    {
+        size_ = 0;
+        if(data_)
+            pad();
+    }
+};
+
+#if defined(HTTP_CLIENT_SIMDJSON)
+static_assert(PaddedBuffer::padding >= simdjson::SIMDJSON_PADDING, "simdjson reads further past the body than it is padded");
+#endif
+
+// Recycles response buffers, so steady traffic reads into storage that
+// is already allocated and sized instead of growing a new string per
+// response. Buffers that grew past max_capacity are freed rather than
+// kept.
+class BufferPool
+{
+    std::mutex mutex_;
+    std::vector<PaddedBuffer> free_;
+    std::size_t max_buffers_;
+    std::size_t max_capacity_;
+
+public:
+    explicit
+    BufferPool(
+        std::size_t max_buffers = 64,
+        std::size_t max_capacity = 4 * 1024 * 1024
+    ) : max_buffers_(max_buffers), max_capacity_(max_capacity)
+    {
+    }
+
+    // A cleared buffer, the largest one free
+    PaddedBuffer
+    acquire()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(free_.empty())
+            return {};
+        auto buffer = std::move(free_.back());
+        free_.pop_back();
+        return buffer;
+    }
+
+    void
+    release(PaddedBuffer buffer)
+    {
+        if(!buffer.capacity() || buffer.capacity() > max_capacity_)
+            return;
+        buffer.clear();
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if(free_.size() >= max_buffers_)
+            return;
+
+        // kept sorted by capacity, so the largest is handed out first
+        auto it = std::upper_bound(free_.begin(), free_.end(), buffer.capacity(),
+            [](std::size_t capacity, const PaddedBuffer& free){
+                return capacity < free.capacity();
+            });
+        free_.insert(it, std::move(buffer));
+    }
+
+    void
+    limits(std::size_t max_buffers, std::size_t max_capacity)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        max_buffers_ = max_buffers;
+        max_capacity_ = max_capacity;
+        if(free_.size() > max_buffers_)
+            free_.resize(max_buffers_);
+        free_.erase(std::remove_if(free_.begin(), free_.end(), [&](const PaddedBuffer& free){
+            return free.capacity() > max_capacity_;
+        }), free_.end());
+    }
+
+    std::size_t
+    size()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return free_.size();
+    }
+
+    void
+    clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.clear();
+    }
+};
+
+// A response body read straight into a PaddedBuffer. The buffer is
+// cleared, not replaced, when a new body starts, so a recycled one
+// keeps its storage.
+struct padded_body
+{
+    using value_type = PaddedBuffer;
+
+    static std::uint64_t
+    size(const value_type& body)
+    {
+        return body.size();
+    }
+
+    class reader
+    {
+        value_type& body_;
+
+    public:
+        template<bool isRequest, class Fields>
+        explicit
+        reader(http::header<isRequest, Fields>&, value_type& body)
+            : body_(body)
+        {
+        }
+
+        void
+        init(const boost::optional<std::uint64_t>& length, beast::error_code& ec)
+        {
+            if(length && *length > (std::numeric_limits<std::size_t>::max)() - PaddedBuffer::padding){
+                ec = http::error::buffer_overflow;
+                return;
+            }
+
+            // an empty body still gets its padding to point at
+            body_.clear();
+            body_.reserve(length ? static_cast<std::size_t>(*length) : 0);
+            ec = {};
+        }
+
+        template<class ConstBufferSequence>
+        std::size_t
+        put(const ConstBufferSequence& buffers, beast::error_code& ec)
+        {
+            auto n = asio::buffer_size(buffers);
+            asio::buffer_copy(asio::buffer(body_.prepare(n), n), buffers);
+            body_.commit(n);
+            ec = {};
+            return n;
+        }
+
+        void
+        finish(beast::error_code& ec)
+        {
+            ec = {};
+        }
+    };
+};
+
+// What an async session hands its response to
+using ResponseHandler = std::function<void(http::response<padded_body>&)>;
+
+#endif // PADDED_BODY_HPP
@@ -0,0 +1,314 @@
+#ifndef REQUEST_EXCHANGE_HPP
+#define REQUEST_EXCHANGE_HPP
+//include build options
+#include "httpConfig.hpp"
+//include asio
+#include <boost/asio.hpp>
+//include beast
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+//include padded response bodies
+#include "paddedBody.hpp"
+//include request tracing
+#include "flightRecorder.hpp"
+//include boost
+#include <boost/optional.hpp>
+//include others
+#include <chrono>
+#include <functional>
+#include <memory>
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+// True if the request asks the server for a 100 Continue before its body
+template<class Body>
+bool
+expects_continue(const http::request<Body>& request)
+{
+    return beast::iequals(request[http::field::expect], "100-continue");
+}
+
+// 1xx responses other than 101 precede the final response
+template<class Body>
+bool
+is_interim(const http::response<Body>& response)
+{
+    auto status = response.result_int();
+    return status >= 100 && status < 200 && status != 101;
+}
+
+// Start a response over before reading another one into it
+template<class Body>
+void
+reset_response(http::response<Body>& response)
+{
+    response = {};
+}
+
+// A padded body keeps its buffer, which may be a recycled one
+inline void
+reset_response(http::response<padded_body>& response)
+{
+    response.base() = {};
+    response.body().clear();
+}
+
+// Read the final response, skipping interim ones like 100 Continue. The
+// header is read first, so trace gets the final response's first byte.
+template<class Stream, class Body>
+void
+read_response(Stream& stream, beast::flat_buffer& buffer, http::response<Body>& response, beast::error_code& ec, const FlightTrace* trace = nullptr)
+{
+    do{
+        reset_response(response);
+        http::response_parser<Body> parser(std::move(response));
+        http::read_header(stream, buffer, parser, ec);
+        if(!ec){
+            if(trace && !is_interim(parser.get()))
+                trace->record(FlightEvent::first_byte);
+            http::read(stream, buffer, parser, ec);
+        }
+        response = parser.release();
+    }while(!ec && is_interim(response));
+
+    if(!ec && trace)
+        trace->record(FlightEvent::last_byte, response.result_int());
+}
+
+// Writes a request and reads its response at the same time, so a final
+// response that comes while the body is still going out, e.g. a 401, a
+// 413 or a redirect, ends the upload instead of waiting for it. With
+// Expect: 100-continue only the header is sent at first, and the body
+// follows a 100 Continue or, if the server doesn't answer in time, the
+// continue timeout; a final response instead skips the body. Interim
+// responses are skipped. Reads go to ReadStream, writes to WriteStream,
+// the TCP stream below a TLS stream with kernel TLS. The final response's
+// first and last byte go to the trace, if there is one. Must be driven
+// from the loop thread of the streams' io_context.
+template<class ReadStream, class WriteStream, class Body, class ResponseBody = http::string_body>
+class RequestExchange : public std::enable_shared_from_this<RequestExchange<ReadStream, WriteStream, Body, ResponseBody>>
+{
+public:
+    // Writes the whole request, for callers with their own way of sending it
+    using Writer = std::function<void(std::function<void(beast::error_code, std::size_t)>)>;
+
+    // complete is true if the whole request went out and the connection
+    // is still open, only then can it be used again
+    using Handler = std::function<void(beast::error_code ec, bool complete)>;
+
+private:
+    ReadStream& read_stream_;
+    WriteStream& write_stream_;
+    http::request<Body>& request_;
+    beast::flat_buffer& buffer_;
+    http::response<ResponseBody>& response_;
+    boost::optional<http::response_parser<ResponseBody>> parser_;
+    std::chrono::steady_clock::duration continue_timeout_;
+    std::unique_ptr<http::request_serializer<Body>> serializer_;
+    asio::steady_timer continue_timer_;
+    Writer writer_;
+    Handler handler_;
+    const FlightTrace* trace_ = nullptr;
+    std::size_t pending_ = 0;       // reads and writes in flight
+    bool continuing_ = false;       // header sent, waiting to send the body
+    bool sent_ = false;             // the whole request went out
+    bool responded_ = false;        // the final response is in
+    bool stopped_ = false;          // the connection was closed under what is in flight
+    beast::error_code error_;       // the first error, what the exchange failed with
+
+    void
+    write_header()
+    {
+        auto self = this->shared_from_this();
+        serializer_.reset(new http::request_serializer<Body>(request_));
+        ++pending_;
+        http::async_write_header(write_stream_, *serializer_,
+            [self](beast::error_code ec, std::size_t){
+                --self->pending_;
+                if(ec)
+                    return self->failed(ec);
+
+                // give the server a moment to accept or turn down the body
+                self->continuing_ = true;
+                self->continue_timer_.expires_after(self->continue_timeout_);
+                self->continue_timer_.async_wait([self](beast::error_code ec){
+                    if(ec || !self->continuing_)
+                        return;
+                    self->continuing_ = false;
+                    self->write();
+                });
+                self->read();
+            });
+    }
+
+    void
+    write()
+    {
+        auto self = this->shared_from_this();
+        auto on_write = [self](beast::error_code ec, std::size_t){
+            --self->pending_;
+            if(ec)
+                return self->failed(ec);
+            self->sent_ = true;
+            self->maybe_done();
+        };
+
+        ++pending_;
+        if(serializer_)
+            http::async_write(write_stream_, *serializer_, on_write);
+        else if(writer_)
+            writer_(on_write);
+        else
+            http::async_write(write_stream_, request_, on_write);
+    }
+
+    // The header first, then the rest. The response is moved into the
+    // parser meanwhile, so a recycled body keeps its buffer.
+    void
+    read()
+    {
+        auto self = this->shared_from_this();
+        reset_response(response_);
+        parser_.emplace(std::move(response_));
+        ++pending_;
+        http::async_read_header(read_stream_, buffer_, *parser_,
+            [self](beast::error_code ec, std::size_t){
+                if(ec)
+                    return self->on_read(ec);
+
+                if(self->trace_ && !is_interim(self->parser_->get()))
+                    self->trace_->record(FlightEvent::first_byte);
+                http::async_read(self->read_stream_, self->buffer_, *self->parser_,
+                    [self](beast::error_code ec, std::size_t){
+                        self->on_read(ec);
+                    });
+            });
+    }
+
+    void
+    on_read(beast::error_code ec)
+    {
+        --pending_;
+        response_ = parser_->release();
+        parser_.reset();
+        if(ec)
+            return failed(ec);
+
+        if(is_interim(response_)){
+            // the server wants the body
+            if(continuing_ && response_.result() == http::status::continue_){
+                continuing_ = false;
+                continue_timer_.cancel();
+                write();
+            }
+            return read();
+        }
+
+        // a final response while the body is pending or going out means
+        // the server won't read it, so don't send the rest
+        if(trace_)
+            trace_->record(FlightEvent::last_byte, response_.result_int());
+        responded_ = true;
+        continuing_ = false;
+        continue_timer_.cancel();
+        if(pending_)
+            stop();
+        maybe_done();
+    }
+
+    void
+    failed(beast::error_code ec)
+    {
+        // once stopped, the other direction fails because of the close
+        if(!stopped_ && !error_)
+            error_ = ec;
+        continuing_ = false;
+        continue_timer_.cancel();
+        if(pending_)
+            stop();
+        maybe_done();
+    }
+
+    // Close the connection, which can't carry another request now.
+    // Unlike a cancel this also ends a TLS write between two socket
+    // writes, at its next step.
+    void
+    stop()
+    {
+        stopped_ = true;
+        beast::get_lowest_layer(read_stream_).close();
+    }
+
+    void
+    maybe_done()
+    {
+        if(pending_ || continuing_ || !handler_)
+            return;
+
+        // once the response is in, a failed upload only costs the connection
+        auto handler = std::move(handler_);
+        if(responded_)
+            return handler({}, sent_ && !stopped_);
+        handler(error_, false);
+    }
+
+public:
+    RequestExchange(
+        ReadStream& read_stream,
+        WriteStream& write_stream,
+        http::request<Body>& request,
+        beast::flat_buffer& buffer,
+        http::response<ResponseBody>& response,
+        std::chrono::steady_clock::duration continue_timeout
+    ) : read_stream_(read_stream)
+      , write_stream_(write_stream)
+      , request_(request)
+      , buffer_(buffer)
+      , response_(response)
+      , continue_timeout_(continue_timeout)
+      , continue_timer_(read_stream.get_executor())
+    {
+    }
+
+    // writer replaces http::async_write for the whole request, it isn't
+    // used for requests that expect a 100 Continue. trace has to outlive
+    // the exchange.
+    void
+    run(Handler handler, Writer writer = nullptr, const FlightTrace* trace = nullptr)
+    {
+        handler_ = std::move(handler);
+        writer_ = std::move(writer);
+        trace_ = trace;
+
+        if(expects_continue(request_) && request_.has_content_length()){
+            write_header();
+            return;
+        }
+
+        write();
+        read();
+    }
+};
+
+// Run a request exchange, see RequestExchange
+template<class ReadStream, class WriteStream, class Body, class ResponseBody>
+void
+async_exchange(
+    ReadStream& read_stream,
+    WriteStream& write_stream,
+    http::request<Body>& request,
+    beast::flat_buffer& buffer,
+    http::response<ResponseBody>& response,
+    std::chrono::steady_clock::duration continue_timeout,
+    typename RequestExchange<ReadStream, WriteStream, Body, ResponseBody>::Handler handler,
+    typename RequestExchange<ReadStream, WriteStream, Body, ResponseBody>::Writer writer = nullptr,
+    const FlightTrace* trace = nullptr
+){
+    std::make_shared<RequestExchange<ReadStream, WriteStream, Body, ResponseBody>>(
+        read_stream, write_stream, request, buffer, response, continue_timeout
+    )->run(std::move(handler), std::move(writer), trace);
+}
+
+#endif // REQUEST_EXCHANGE_HPP
@@ -0,0 +1,390 @@
+#ifndef REQUEST_GOVERNOR_HPP
+#define REQUEST_GOVERNOR_HPP
+//include build options
+#include "httpConfig.hpp"
+//include asio
+#include <boost/asio.hpp>
+//include beast
+#include <boost/beast/core/error.hpp>
+//include request state
+#include "requestHandle.hpp"
+//include others
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+
+// What happens to a request that can't start right away
+enum class OverflowPolicy {
+    reject,         // fail immediately, never queue
+    wait,           // queue until admitted or max_wait passes, reject when the queue is full
+    drop_lowest     // like wait, but a full queue drops its lowest priority request instead
+};
+
+// Limits applied per host. Zero means unlimited.
+struct HostLimits {
+    double rate = 0;                    // requests admitted per second
+    double burst = 0;                   // token bucket size, defaults to max(rate, 1)
+    std::size_t max_in_flight = 0;      // concurrently running requests
+    std::size_t max_queued = 1024;      // waiting requests
+    OverflowPolicy overflow = OverflowPolicy::wait;
+    std::chrono::milliseconds max_wait = std::chrono::seconds(5);
+};
+
+// Counters for a single host, cumulative except where noted
+struct GovernorStats {
+    std::uint64_t admitted = 0;
+    std::uint64_t queued = 0;
+    std::uint64_t rejected = 0;
+    std::uint64_t dropped = 0;
+    std::uint64_t expired = 0;
+    std::uint64_t cancelled = 0;
+    std::size_t in_flight = 0;          // current
+    std::size_t queue_depth = 0;        // current
+    double tokens = 0;                  // current
+};
+
+// Admits async requests per host through a token bucket and an
+// in-flight cap. Requests that can't start are held in a bounded
+// priority queue, highest priority first and FIFO within a priority.
+class RequestGovernor
+{
+public:
+    using Start = std::function<void()>;
+    using Reject = std::function<void(beast::error_code)>;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    // highest priority first, then oldest first
+    using QueueKey = std::pair<int, std::uint64_t>;
+
+    struct Pending {
+        Clock::time_point deadline;
+        std::shared_ptr<RequestState> state;
+        Start start;
+        Reject reject;
+    };
+
+    struct Host {
+        HostLimits limits;
+        double tokens = 0;
+        Clock::time_point refilled;
+        std::map<QueueKey, Pending> queue;
+        std::unique_ptr<asio::steady_timer> timer;
+        Clock::time_point timer_at = Clock::time_point::max();
+        GovernorStats stats;
+    };
+
+    // Work to run once the lock is released
+    struct Actions {
+        std::vector<std::pair<Start, std::shared_ptr<RequestState>>> starts;
+        std::vector<std::pair<Reject, beast::error_code>> rejects;
+    };
+
+    asio::io_context& io_;
+    std::mutex mutex_;
+    HostLimits defaults_;
+    std::unordered_map<std::string, HostLimits> configured_;
+    std::unordered_map<std::string, Host> hosts_;
+    std::uint64_t seq_ = 0;
+    bool closed_ = false;
+
+    static double
+    bucket_size(const HostLimits& limits)
+    {
+        return limits.burst > 0 ? limits.burst : std::max(limits.rate, 1.0);
+    }
+
+    Host&
+    host(const std::string& name)
+    {
+        auto it = hosts_.find(name);
+        if(it != hosts_.end())
+            return it->second;
+
+        auto& h = hosts_[name];
+        auto limits = configured_.find(name);
+        h.limits = limits != configured_.end() ? limits->second : defaults_;
+        h.tokens = bucket_size(h.limits);
+        h.refilled = Clock::now();
+        return h;
+    }
+
+    void
+    refill(Host& h, Clock::time_point now)
+    {
+        if(h.limits.rate <= 0)
+            return;
+
+        std::chrono::duration<double> elapsed = now - h.refilled;
+        h.tokens = std::min(bucket_size(h.limits), h.tokens + elapsed.count() * h.limits.rate);
+        h.refilled = now;
+    }
+
+    bool
+    can_admit(const Host& h) const
+    {
+        if(h.limits.max_in_flight && h.stats.in_flight >= h.limits.max_in_flight)
+            return false;
+        return h.limits.rate <= 0 || h.tokens >= 1;
+    }
+
+    void
+    admit(const std::string& name, Host& h, Start start, std::shared_ptr<RequestState> state, Actions& actions)
+    {
+        if(h.limits.rate > 0)
+            h.tokens -= 1;
+        ++h.stats.in_flight;
+        ++h.stats.admitted;
+
+        // the slot is returned when the request finishes, however it finishes
+        state->on_finish([this, name]{ release(name); });
+        actions.starts.emplace_back(std::move(start), std::move(state));
+    }
+
+    // Expire overdue requests, admit what the limits allow and
+    // arm the timer for the next deadline or token
+    void
+    pump(const std::string& name, Host& h, Actions& actions)
+    {
+        auto now = Clock::now();
+        refill(h, now);
+
+        for(auto it = h.queue.begin(); it != h.queue.end();){
+            if(it->second.deadline <= now){
+                ++h.stats.expired;
+                actions.rejects.emplace_back(std::move(it->second.reject), asio::error::timed_out);
+                it = h.queue.erase(it);
+            }else{
+                ++it;
+            }
+        }
+
+        while(!h.queue.empty() && can_admit(h)){
+            auto pending = std::move(h.queue.begin()->second);
+            h.queue.erase(h.queue.begin());
+            admit(name, h, std::move(pending.start), std::move(pending.state), actions);
+        }
+
+        h.stats.queue_depth = h.queue.size();
+        if(h.queue.empty())
+            return;
+
+        auto next = Clock::time_point::max();
+        for(auto& entry : h.queue){
+            next = std::min(next, entry.second.deadline);
+        }
+        bool slot_free = !h.limits.max_in_flight || h.stats.in_flight < h.limits.max_in_flight;
+        if(slot_free && h.limits.rate > 0){
+            auto wait = std::chrono::duration<double>((1 - h.tokens) / h.limits.rate);
+            next = std::min(next, now + std::chrono::duration_cast<Clock::duration>(wait));
+        }
+        arm(name, h, next);
+    }
+
+    void
+    arm(const std::string& name, Host& h, Clock::time_point at)
+    {
+        if(!h.timer)
+            h.timer = std::make_unique<asio::steady_timer>(io_);
+        if(at >= h.timer_at)
+            return;
+
+        h.timer_at = at;
+        h.timer->expires_at(at);
+        h.timer->async_wait([this, name](beast::error_code ec){
+            if(ec == asio::error::operation_aborted)
+                return;
+
+            Actions actions;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if(closed_)
+                    return;
+                auto& h = host(name);
+                h.timer_at = Clock::time_point::max();
+                pump(name, h, actions);
+            }
+            run(actions);
+        });
+    }
+
+    void
+    release(const std::string& name)
+    {
+        Actions actions;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(closed_)
+                return;
+            auto& h = host(name);
+            --h.stats.in_flight;
+            pump(name, h, actions);
+        }
+        run(actions);
+    }
+
+    void
+    remove(const std::string& name, QueueKey key)
+    {
+        Actions actions;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto& h = host(name);
+            auto it = h.queue.find(key);
+            if(it == h.queue.end())
+                return;
+
+            ++h.stats.cancelled;
+            actions.rejects.emplace_back(std::move(it->second.reject), asio::error::operation_aborted);
+            h.queue.erase(it);
+            h.stats.queue_depth = h.queue.size();
+        }
+        run(actions);
+    }
+
+    static void
+    run(Actions& actions)
+    {
+        for(auto& reject : actions.rejects){
+            reject.first(reject.second);
+        }
+        for(auto& start : actions.starts){
+            start.first();
+        }
+    }
+
+public:
+    explicit
+    RequestGovernor(asio::io_context& io)
+        : io_(io)
+    {
+    }
+
+    // Limits for hosts without their own
+    void
+    defaults(const HostLimits& limits)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        defaults_ = limits;
+    }
+
+    // Limits for a single host, takes effect for new and queued requests
+    void
+    limit(const std::string& name, const HostLimits& limits)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        configured_[name] = limits;
+        auto it = hosts_.find(name);
+        if(it != hosts_.end()){
+            it->second.limits = limits;
+            it->second.tokens = std::min(it->second.tokens, bucket_size(limits));
+        }
+    }
+
+    GovernorStats
+    stats(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& h = host(name);
+        refill(h, Clock::now());
+        auto stats = h.stats;
+        stats.tokens = h.limits.rate > 0 ? h.tokens : 0;
+        return stats;
+    }
+
+    /*
+    Start a request now, queue it, or reject it per the host's limits.
+    @param name: host the limits apply to
+    @param priority: larger values are admitted first
+    @param state: request state, released back to the governor on completion
+    @param start: starts the request, invoked at most once
+    @param reject: invoked instead of start with timed_out, operation_aborted or
+    resource_unavailable_try_again when the request is dropped
+    */
+    void
+    submit(
+        const std::string& name,
+        int priority,
+        std::shared_ptr<RequestState> state,
+        Start start,
+        Reject reject
+    ){
+        Actions actions;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(closed_){
+                actions.rejects.emplace_back(std::move(reject), asio::error::operation_aborted);
+            }else{
+                auto& h = host(name);
+                refill(h, Clock::now());
+
+                auto overloaded = beast::errc::make_error_code(beast::errc::resource_unavailable_try_again);
+                if(h.queue.empty() && can_admit(h)){
+                    admit(name, h, std::move(start), std::move(state), actions);
+                }else if(h.limits.overflow == OverflowPolicy::reject){
+                    ++h.stats.rejected;
+                    actions.rejects.emplace_back(std::move(reject), overloaded);
+                }else{
+                    QueueKey key{-priority, seq_++};
+                    bool full = h.limits.max_queued && h.queue.size() >= h.limits.max_queued;
+                    if(full && h.limits.overflow == OverflowPolicy::drop_lowest &&
+                        std::prev(h.queue.end())->first.first > key.first){
+                        auto lowest = std::prev(h.queue.end());
+                        ++h.stats.dropped;
+                        actions.rejects.emplace_back(std::move(lowest->second.reject), overloaded);
+                        h.queue.erase(lowest);
+                        full = false;
+                    }
+
+                    if(full){
+                        ++h.stats.rejected;
+                        actions.rejects.emplace_back(std::move(reject), overloaded);
+                    }else{
+                        ++h.stats.queued;
+                        state->on_cancel([this, name, key]{ remove(name, key); });
+                        h.queue.emplace(key, Pending{
+                            Clock::now() + h.limits.max_wait,
+                            std::move(state),
+                            std::move(start),
+                            std::move(reject)
+                        });
+                        pump(name, h, actions);
+                    }
+                }
+            }
+        }
+        run(actions);
+    }
+
+    // Reject everything queued and stop admitting, used on shutdown
+    void
+    close()
+    {
+        Actions actions;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+            for(auto& h : hosts_){
+                for(auto& entry : h.second.queue){
+                    actions.rejects.emplace_back(std::move(entry.second.reject), asio::error::operation_aborted);
+                }
+                h.second.queue.clear();
+                h.second.timer.reset();
+            }
+        }
+        run(actions);
+    }
+};
+
+#endif // REQUEST_GOVERNOR_HPP
@@ -0,0 +1,129 @@
+#ifndef REQUEST_HANDLE_HPP
+#define REQUEST_HANDLE_HPP
+//include build options
+#include "httpConfig.hpp"
+//include beast
+#include <boost/beast/core/error.hpp>
+//include others
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace beast = boost::beast;
+
+// State shared between an in-flight session and the handle given to the caller
+class RequestState
+{
+    std::mutex mutex_;
+    std::condition_variable finished_;
+    std::function<void()> abort_;
+    std::function<void()> finish_;
+    beast::error_code error_;
+    std::atomic<bool> cancelled_{false};
+    std::atomic<bool> done_{false};
+
+public:
+    // Installed by the session, posts the abort onto its loop
+    void
+    on_cancel(std::function<void()> abort)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        abort_ = std::move(abort);
+    }
+
+    // Invoked once when the request completes, however it completes
+    void
+    on_finish(std::function<void()> finish)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        finish_ = std::move(finish);
+    }
+
+    void
+    cancel()
+    {
+        std::function<void()> abort;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(done_ || cancelled_)
+                return;
+            cancelled_ = true;
+            abort = abort_;
+        }
+        if(abort)
+            abort();
+    }
+
+    void
+    complete(beast::error_code ec)
+    {
+        std::function<void()> finish;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(done_)
+                return;
+            error_ = ec;
+            done_ = true;
+            abort_ = nullptr;
+            finish.swap(finish_);
+        }
+        finished_.notify_all();
+        if(finish)
+            finish();
+    }
+
+    bool cancelled() const { return cancelled_; }
+    bool done() const { return done_; }
+
+    beast::error_code
+    error()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return error_;
+    }
+
+    template<class Rep, class Period>
+    bool
+    wait_for(std::chrono::duration<Rep, Period> timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return finished_.wait_for(lock, timeout, [this]{ return done_.load(); });
+    }
+
+    void
+    wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        finished_.wait(lock, [this]{ return done_.load(); });
+    }
+};
+
+// Returned by AsyncHttpClient::then() to observe or abort the request.
+// Cancelling aborts whichever step is in flight (resolve, connect,
+// handshake, write or read) and closes the connection instead of
+// returning it to the pool. The callback is not invoked afterwards.
+class RequestHandle
+{
+    std::shared_ptr<RequestState> state_;
+
+public:
+    RequestHandle() = default;
+    explicit RequestHandle(std::shared_ptr<RequestState> state) : state_(std::move(state)){}
+
+    void cancel(){ if(state_) state_->cancel(); }
+    bool done() const { return !state_ || state_->done(); }
+    bool cancelled() const { return state_ && state_->cancelled(); }
+
+    // Error the request finished with, operation_aborted if cancelled
+    beast::error_code error() const { return state_ ? state_->error() : beast::error_code{}; }
+
+    void wait(){ if(state_) state_->wait(); }
+
+    template<class Rep, class Period>
+    bool wait_for(std::chrono::duration<Rep, Period> timeout){ return !state_ || state_->wait_for(timeout); }
+};
+
+#endif // REQUEST_HANDLE_HPP
@@ -0,0 +1,117 @@
+#ifndef REQUEST_RECORDER_HPP
+#define REQUEST_RECORDER_HPP
+//include build options
+#include "httpConfig.hpp"
+//include beast
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+//include others
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+
+// Appends every request made on a context to a JSON lines log, one
+// object per request:
+//
+//   {"time_us":1700000000000000,"method":"POST","url":"https://host/path",
+//    "headers":{"Content-Type":"application/json"},"body":"{}"}
+//
+// time_us is the wall clock time the request was issued at, in
+// microseconds. Host and Content-Length are left out, they follow from
+// the url and the body. File bodies are recorded without their body.
+// tools/replay.cpp replays such a log.
+class RequestRecorder
+{
+    std::mutex mutex_;
+    std::ofstream out_;
+
+    static void
+    escape(std::string& out, beast::string_view text)
+    {
+        out += '"';
+        for(unsigned char c : text){
+            switch(c){
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if(c < 0x20){
+                    char code[7];
+                    std::snprintf(code, sizeof(code), "\\u%04x", c);
+                    out += code;
+                }else{
+                    out += static_cast<char>(c);
+                }
+            }
+        }
+        out += '"';
+    }
+
+    template<class Body>
+    static beast::string_view
+    body(const http::request<Body>&)
+    {
+        return {};
+    }
+
+    static beast::string_view
+    body(const http::request<http::string_body>& request)
+    {
+        return request.body();
+    }
+
+public:
+    // Appends to the log at path
+    explicit
+    RequestRecorder(const std::string& path)
+        : out_(path, std::ios::app)
+    {
+        if(!out_)
+            throw beast::system_error{beast::error_code(errno, boost::system::system_category()), path};
+    }
+
+    template<class Body>
+    void
+    record(const std::string& type, const std::string& host, const http::request<Body>& request)
+    {
+        auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+
+        // unix:///path/to.sock:/request/path, the form the clients parse
+        auto url = type + "://" + host + (type == "unix" ? ":" : "") + std::string(request.target());
+
+        std::string line = "{\"time_us\":" + std::to_string(now) + ",\"method\":";
+        escape(line, request.method_string());
+        line += ",\"url\":";
+        escape(line, url);
+        line += ",\"headers\":{";
+        bool first = true;
+        for(auto& field : request){
+            if(field.name() == http::field::host || field.name() == http::field::content_length)
+                continue;
+            if(!first)
+                line += ',';
+            first = false;
+            escape(line, field.name_string());
+            line += ':';
+            escape(line, field.value());
+        }
+        line += "},\"body\":";
+        escape(line, body(request));
+        line += "}\n";
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        out_ << line;
+        out_.flush();
+    }
+};
+
+#endif // REQUEST_RECORDER_HPP
@@ -0,0 +1,100 @@
+#ifndef SHARDED_CLIENT_CONTEXT_HPP
+#define SHARDED_CLIENT_CONTEXT_HPP
+//include build options
+#include "httpConfig.hpp"
+//include a single shard
+#include "clientContext.hpp"
+//include others
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+// Thread-per-core mode: one ClientContext per shard, each with its own
+// loop thread, connection pool, DNS cache, governor and balancer, so
+// requests from different cores share no locks or cache lines. Each
+// application thread sticks to one shard, the one for the core it first
+// submitted from when that is known, and submits into that shard's
+// lock-free queue. Limits configured per host apply per shard.
+class ShardedClientContext
+{
+    std::vector<std::unique_ptr<ClientContext>> shards_;
+    std::atomic<std::size_t> next_{0};
+    std::uint64_t id_;
+
+    static std::uint64_t
+    next_id()
+    {
+        static std::atomic<std::uint64_t> ids{1};
+        return ids++;
+    }
+
+    std::size_t
+    pick()
+    {
+#if defined(__linux__)
+        auto cpu = sched_getcpu();
+        if(cpu >= 0)
+            return static_cast<std::size_t>(cpu) % shards_.size();
+#endif
+        return next_++ % shards_.size();
+    }
+
+public:
+    /*
+    @param shards: number of shards, defaults to one per hardware thread
+    @param pin: pin shard i's loop thread to core i
+    */
+    explicit
+    ShardedClientContext(std::size_t shards = 0, bool pin = false)
+        : id_(next_id())
+    {
+        if(shards == 0)
+            shards = std::max(1u, std::thread::hardware_concurrency());
+
+        shards_.reserve(shards);
+        for(std::size_t i = 0; i < shards; ++i){
+            shards_.emplace_back(new ClientContext(pin ? static_cast<int>(i) : -1));
+        }
+    }
+
+    ShardedClientContext(const ShardedClientContext&) = delete;
+    ShardedClientContext& operator=(const ShardedClientContext&) = delete;
+
+    std::size_t size() const { return shards_.size(); }
+    ClientContext& shard(std::size_t index){ return *shards_[index]; }
+
+    // The calling thread's shard
+    ClientContext&
+    local()
+    {
+        struct Cached {
+            std::uint64_t owner = 0;
+            std::size_t index = 0;
+        };
+        thread_local Cached cached;
+
+        if(cached.owner != id_){
+            cached.owner = id_;
+            cached.index = pick();
+        }
+        return *shards_[cached.index];
+    }
+
+    // Apply configuration to every shard, e.g. governor limits
+    void
+    for_each(const std::function<void(ClientContext&)>& fn)
+    {
+        for(auto& shard : shards_){
+            fn(*shard);
+        }
+    }
+};
+
+#endif // SHARDED_CLIENT_CONTEXT_HPP
@@ -0,0 +1,400 @@
+#ifndef SOCKET_PROFILE_HPP
+#define SOCKET_PROFILE_HPP
+//include build options
+#include "httpConfig.hpp"
+//include asio
+#include <boost/asio.hpp>
+//include beast
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+//include stream types
+#include "connectionPool.hpp"
+//include others
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#if defined(__linux__)
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
+namespace asio = boost::asio;
+namespace beast = boost::beast;
+namespace http = beast::http;
+using tcp = boost::asio::ip::tcp;
+
+// Socket options for new TCP connections. Options the platform or the
+// kernel doesn't support are skipped.
+struct SocketProfile {
+    bool no_delay = true;                           // TCP_NODELAY, small writes don't wait on Nagle
+    int send_buffer = 0;                            // SO_SNDBUF in bytes, 0 keeps the kernel's autotuning
+    int receive_buffer = 0;                         // SO_RCVBUF in bytes, 0 keeps the kernel's autotuning
+    bool fast_open = false;                         // TCP_FASTOPEN_CONNECT, reconnects send the request in the SYN
+    std::chrono::seconds keepalive_idle{0};         // idle time before keepalive probes, 0 disables them
+    std::chrono::seconds keepalive_interval{10};
+    int keepalive_count = 3;                        // unanswered probes before the connection is dropped
+    std::chrono::microseconds busy_poll{0};         // SO_BUSY_POLL, spin on the device queue instead of sleeping
+    bool zerocopy = false;                          // large plain HTTP bodies go out with MSG_ZEROCOPY
+};
+
+// Bodies smaller than this are cheaper to copy than to pin and track
+constexpr std::size_t zerocopy_min_body = 64 * 1024;
+
+#if defined(__linux__)
+constexpr int zerocopy_send_flags = MSG_ZEROCOPY;
+#else
+constexpr int zerocopy_send_flags = 0;
+#endif
+
+// Set profile's options on an open socket, before it connects
+inline void
+apply_socket_profile(tcp::socket& socket, const SocketProfile& profile)
+{
+    beast::error_code ignored;
+    socket.set_option(tcp::no_delay(profile.no_delay), ignored);
+    if(profile.send_buffer > 0)
+        socket.set_option(asio::socket_base::send_buffer_size(profile.send_buffer), ignored);
+    if(profile.receive_buffer > 0)
+        socket.set_option(asio::socket_base::receive_buffer_size(profile.receive_buffer), ignored);
+
+#if defined(__linux__)
+    int fd = socket.native_handle();
+    int on = 1;
+    if(profile.fast_open)
+        ::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+    if(profile.keepalive_idle.count() > 0){
+        int idle = static_cast<int>(profile.keepalive_idle.count());
+        int interval = static_cast<int>(profile.keepalive_interval.count());
+        ::setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+        ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+        ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+        ::setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &profile.keepalive_count, sizeof(profile.keepalive_count));
+    }
+    if(profile.busy_poll.count() > 0){
+        int usecs = static_cast<int>(profile.busy_poll.count());
+        ::setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+    }
+    if(profile.zerocopy)
+        ::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on));
+#else
+    if(profile.keepalive_idle.count() > 0)
+        socket.set_option(asio::socket_base::keep_alive(true), ignored);
+#endif
+}
+
+// Counts the MSG_ZEROCOPY sends of a request and the kernel's reports
+// that it is done with them. Until then the kernel may still read the
+// body from its pages, so the body must stay alive and unchanged.
+class ZerocopyTracker
+{
+    std::uint32_t sent_ = 0;
+    std::uint32_t completed_ = 0;
+    bool copied_ = false;
+
+public:
+    void sent(){ ++sent_; }
+    bool done() const { return completed_ == sent_; }
+
+    // True if the kernel fell back to copying, e.g. on loopback
+    bool copied() const { return copied_; }
+
+    // Collect the completions queued on the socket, returns how many
+    std::uint32_t
+    reap(tcp::socket& socket)
+    {
+        std::uint32_t reaped = 0;
+#if defined(__linux__)
+        for(;;){
+            char control[128];
+            msghdr message{};
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            if(::recvmsg(socket.native_handle(), &message, MSG_ERRQUEUE) < 0){
+                if(errno == EINTR)
+                    continue;
+                return reaped;
+            }
+
+            for(auto cmsg = CMSG_FIRSTHDR(&message); cmsg; cmsg = CMSG_NXTHDR(&message, cmsg)){
+                bool recverr = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                    || (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+                if(!recverr)
+                    continue;
+
+                // a completion covers the range of sends [ee_info, ee_data]
+                auto error = reinterpret_cast<sock_extended_err*>(CMSG_DATA(cmsg));
+                if(error->ee_origin != SO_EE_ORIGIN_ZEROCOPY || error->ee_errno != 0)
+                    continue;
+                auto count = error->ee_data - error->ee_info + 1;
+                completed_ += count;
+                reaped += count;
+                if(error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                    copied_ = true;
+            }
+        }
+#else
+        boost::ignore_unused(socket);
+        return reaped;
+#endif
+    }
+
+    // Block until every send has completed
+    void
+    wait(tcp::socket& socket, beast::error_code& ec)
+    {
+#if defined(__linux__)
+        reap(socket);
+        while(!done()){
+            // completions raise POLLERR, which poll always reports
+            pollfd descriptor{socket.native_handle(), 0, 0};
+            auto ready = ::poll(&descriptor, 1, 30000);
+            if(ready == 0){
+                ec = asio::error::timed_out;
+                return;
+            }
+            if(ready < 0){
+                if(errno == EINTR)
+                    continue;
+                ec = beast::error_code(errno, boost::system::system_category());
+                return;
+            }
+
+            // nothing to reap means a real socket error or a hang up
+            if(reap(socket) == 0){
+                int error = 0;
+                socklen_t length = sizeof(error);
+                ::getsockopt(socket.native_handle(), SOL_SOCKET, SO_ERROR, &error, &length);
+                ec = error ? beast::error_code(error, boost::system::system_category())
+                           : beast::error_code(asio::error::connection_aborted);
+                return;
+            }
+        }
+#else
+        boost::ignore_unused(socket, ec);
+#endif
+    }
+
+    // Wait on the loop until every send has completed. Completions
+    // are polled for, since they are normally queued by the time the
+    // response arrives and a missed POLLERR edge would stall the wait.
+    void
+    async_wait(tcp::socket& socket, std::function<void(beast::error_code)> handler)
+    {
+        auto timer = std::make_shared<asio::steady_timer>(socket.get_executor());
+        poll(socket, timer, std::chrono::steady_clock::now() + std::chrono::seconds(30), std::move(handler));
+    }
+
+private:
+    void
+    poll(
+        tcp::socket& socket,
+        std::shared_ptr<asio::steady_timer> timer,
+        std::chrono::steady_clock::time_point deadline,
+        std::function<void(beast::error_code)> handler
+    ){
+        reap(socket);
+        if(done())
+            return handler({});
+        if(std::chrono::steady_clock::now() >= deadline)
+            return handler(asio::error::timed_out);
+
+        timer->expires_after(std::chrono::milliseconds(1));
+        timer->async_wait([this, &socket, timer, deadline, handler](beast::error_code ec){
+            if(ec)
+                return handler(ec);
+            poll(socket, timer, deadline, handler);
+        });
+    }
+};
+
+// True if request's body is large enough for MSG_ZEROCOPY and the
+// socket was opened with a zerocopy profile
+template<class Body>
+bool
+zerocopy_eligible(tcp::socket&, const http::request<Body>&)
+{
+    return false;
+}
+
+inline bool
+zerocopy_eligible(tcp::socket& socket, const http::request<http::string_body>& request)
+{
+#if defined(__linux__)
+    if(request.body().size() < zerocopy_min_body || request.chunked())
+        return false;
+
+    int on = 0;
+    socklen_t length = sizeof(on);
+    return ::getsockopt(socket.native_handle(), SOL_SOCKET, SO_ZEROCOPY, &on, &length) == 0 && on;
+#else
+    boost::ignore_unused(socket, request);
+    return false;
+#endif
+}
+
+// Send one piece of a zerocopy body. Past the socket's optmem limit
+// the kernel refuses to pin more pages, that piece is copied instead.
+inline std::size_t
+send_zerocopy(tcp::socket& socket, asio::const_buffer body, ZerocopyTracker& tracker, beast::error_code& ec)
+{
+#if defined(__linux__)
+    auto sent = socket.send(body, zerocopy_send_flags, ec);
+    if(ec == asio::error::no_buffer_space)
+        return socket.send(body, 0, ec);
+    if(!ec)
+        tracker.sent();
+    return sent;
+#else
+    boost::ignore_unused(tracker);
+    return socket.send(body, 0, ec);
+#endif
+}
+
+// Write request with its body sent straight from the body's pages.
+// Returns false, writing nothing, when the request isn't eligible.
+template<class Body>
+bool
+write_zerocopy(PlainStream&, const http::request<Body>&, ZerocopyTracker&, beast::error_code&)
+{
+    return false;
+}
+
+inline bool
+write_zerocopy(
+    PlainStream& stream,
+    const http::request<http::string_body>& request,
+    ZerocopyTracker& tracker,
+    beast::error_code& ec
+){
+    auto& socket = stream.socket();
+    if(!zerocopy_eligible(socket, request))
+        return false;
+
+    http::request_serializer<http::string_body> serializer(request);
+    http::write_header(stream, serializer, ec);
+
+    auto& body = request.body();
+    std::size_t offset = 0;
+    while(!ec && offset < body.size()){
+        offset += send_zerocopy(socket, asio::buffer(body.data() + offset, body.size() - offset), tracker, ec);
+    }
+    return true;
+}
+
+// Asynchronous write_zerocopy, request must be eligible. The handler
+// gets the bytes written like http::async_write's.
+class ZerocopyWriteOp : public std::enable_shared_from_this<ZerocopyWriteOp>
+{
+    PlainStream& stream_;
+    const http::request<http::string_body>& request_;
+    http::request_serializer<http::string_body> serializer_;
+    ZerocopyTracker& tracker_;
+    std::function<void(beast::error_code, std::size_t)> handler_;
+    asio::steady_timer deadline_;
+    bool timed_out_ = false;
+    std::size_t header_ = 0;
+    std::size_t offset_ = 0;
+
+    void
+    complete(beast::error_code ec)
+    {
+        deadline_.cancel();
+        if(timed_out_)
+            ec = asio::error::timed_out;
+        handler_(ec, header_ + offset_);
+    }
+
+    void
+    on_header(beast::error_code ec, std::size_t bytes_transferred)
+    {
+        header_ = bytes_transferred;
+        if(ec)
+            return complete(ec);
+
+        // the body bypasses the stream, so it gets its own timeout
+        auto self = shared_from_this();
+        deadline_.expires_after(std::chrono::seconds(30));
+        deadline_.async_wait([self](beast::error_code ec){
+            if(ec)
+                return;
+            self->timed_out_ = true;
+            beast::error_code ignored;
+            self->stream_.socket().cancel(ignored);
+        });
+        send();
+    }
+
+    void
+    send()
+    {
+        auto& body = request_.body();
+        if(offset_ == body.size())
+            return complete({});
+
+        auto self = shared_from_this();
+        auto piece = asio::buffer(body.data() + offset_, body.size() - offset_);
+        stream_.socket().async_send(piece, zerocopy_send_flags,
+            [self, piece](beast::error_code ec, std::size_t bytes_transferred){
+                if(ec == asio::error::no_buffer_space){
+                    // past the optmem limit, copy this piece
+                    return self->stream_.socket().async_send(piece, 0,
+                        [self](beast::error_code ec, std::size_t bytes_transferred){
+                            self->on_send(ec, bytes_transferred);
+                        });
+                }
+                if(!ec)
+                    self->tracker_.sent();
+                self->on_send(ec, bytes_transferred);
+            });
+    }
+
+    void
+    on_send(beast::error_code ec, std::size_t bytes_transferred)
+    {
+        offset_ += bytes_transferred;
+        if(ec)
+            return complete(ec);
+        send();
+    }
+
+public:
+    ZerocopyWriteOp(
+        PlainStream& stream,
+        const http::request<http::string_body>& request,
+        ZerocopyTracker& tracker,
+        std::function<void(beast::error_code, std::size_t)> handler
+    ) : stream_(stream)
+      , request_(request)
+      , serializer_(request)
+      , tracker_(tracker)
+      , handler_(std::move(handler))
+      , deadline_(stream.get_executor())
+    {
+    }
+
+    void
+    run()
+    {
+        auto self = shared_from_this();
+        http::async_write_header(stream_, serializer_,
+            [self](beast::error_code ec, std::size_t bytes_transferred){
+                self->on_header(ec, bytes_transferred);
+            });
+    }
+};
+
+inline void
+async_write_zerocopy(
+    PlainStream& stream,
+    const http::request<http::string_body>& request,
+    ZerocopyTracker& tracker,
+    std::function<void(beast::error_code, std::size_t)> handler
+){
+    std::make_shared<ZerocopyWriteOp>(stream, request, tracker, std::move(handler))->run();
+}
+
+#endif // SOCKET_PROFILE_HPP
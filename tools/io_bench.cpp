@@ -0,0 +1,128 @@
+// Measures the async client's event loop against a loopback server:
+// requests per second and client CPU time per request, at a number of
+// requests in flight over pooled keep-alive connections. The backend is
+// fixed when the client is built, so compare epoll and io_uring by
+// running two builds:
+//
+//   cmake -S . -B build && cmake --build build --target io_bench
+//   cmake -S . -B build-uring -DHTTP_CLIENT_IO_URING=ON && cmake --build build-uring --target io_bench
+//   ./build/io_bench --requests 200000 --concurrency 64
+//   ./build-uring/io_bench --requests 200000 --concurrency 64
+
+//include the client's declaration, it's compiled into httpClient.cpp
+#include "httpClient.hpp"
+//include the loopback server
+#include "loopbackServer.hpp"
+//include others
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <iostream>
+#include <string>
+#include <sys/resource.h>
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::size_t requests = 50000;
+    std::size_t concurrency = 32;
+    std::size_t body_size = 64;
+    int rounds = 3;
+};
+
+static void
+usage()
+{
+    std::cerr << "usage: io_bench [--requests N] [--concurrency N] [--body BYTES] [--rounds N]\n"
+                 "  --requests N     requests per round (default 50000)\n"
+                 "  --concurrency N  requests in flight (default 32)\n"
+                 "  --body BYTES     response body size (default 64)\n"
+                 "  --rounds N       measured rounds, after one warm-up (default 3)\n";
+    std::exit(2);
+}
+
+static Options
+parse_options(int argc, char** argv)
+{
+    Options options;
+    for(int i = 1; i < argc; ++i){
+        std::string arg = argv[i];
+        auto value = [&]{
+            if(++i == argc)
+                usage();
+            return std::string(argv[i]);
+        };
+        if(arg == "--requests")
+            options.requests = std::stoul(value());
+        else if(arg == "--concurrency")
+            options.concurrency = std::stoul(value());
+        else if(arg == "--body")
+            options.body_size = std::stoul(value());
+        else if(arg == "--rounds")
+            options.rounds = std::stoi(value());
+        else
+            usage();
+    }
+    if(!options.requests || !options.concurrency)
+        usage();
+    return options;
+}
+
+static long
+context_switches()
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+int
+main(int argc, char** argv)
+{
+    auto options = parse_options(argc, argv);
+
+    LoopbackServer::Options served;
+    served.body_size = options.body_size;
+    LoopbackServer server(served);
+
+    auto context = std::make_shared<ClientContext>();
+    server.route(*context, "bench.local");
+    AsyncHttpClient client(context);
+    client.preconnect("http://bench.local", options.concurrency).wait();
+
+    std::printf("backend %s, %zu requests per round, %zu in flight, %zu byte bodies\n",
+        http_client_io_backend(), options.requests, options.concurrency, options.body_size);
+
+    for(int round = 0; round <= options.rounds; ++round){
+        std::size_t failed = 0;
+        std::deque<RequestHandle> in_flight;
+        auto start = Clock::now();
+        auto cpu = std::clock();
+        auto switches = context_switches();
+
+        // windowed: the oldest request is waited for once the window is full
+        for(std::size_t i = 0; i < options.requests; ++i){
+            if(in_flight.size() == options.concurrency){
+                in_flight.front().wait();
+                failed += in_flight.front().error() ? 1 : 0;
+                in_flight.pop_front();
+            }
+            in_flight.push_back(client.get("http://bench.local/").then([](std::string){}));
+        }
+        for(auto& handle : in_flight){
+            handle.wait();
+            failed += handle.error() ? 1 : 0;
+        }
+
+        auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        auto cpu_us = 1e6 * double(std::clock() - cpu) / CLOCKS_PER_SEC;
+        if(round == 0)
+            continue;       // warm-up
+        std::printf("round %d  %9.0f req/s  cpu/request %6.2f us  context switches/request %5.3f  failed %zu\n",
+            round, options.requests / seconds, cpu_us / options.requests,
+            double(context_switches() - switches) / options.requests, failed);
+    }
+    return 0;
+}
@@ -0,0 +1,184 @@
+// Compares the client CPU time spent per JSON response when the body is
+// copied out and parsed from a padded copy (.then() and a
+// simdjson::padded_string), against parsing it in place in the buffer it
+// was read into (.then_json()). Both modes do the same work per response:
+// walk the "items" array and sum a number field. Run it against a server
+// on another machine or core, its CPU time isn't counted.
+//
+// Built by CMake with HTTP_CLIENT_SIMDJSON=ON (target jsonbench), or by hand:
+//
+//   g++ -std=c++17 -O2 -I. -DHTTP_CLIENT_SEPARATE_COMPILATION -DHTTP_CLIENT_SIMDJSON \
+//       tools/jsonbench.cpp httpClient.cpp -o jsonbench -lsimdjson -lssl -lcrypto -lpthread
+//   ./jsonbench "http://localhost:8080/items?n=1000" --requests 5000 --concurrency 32
+
+//include the client's declaration, it's compiled into httpClient.cpp
+#include "httpClient.hpp"
+//include others
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <iostream>
+#include <string>
+
+#if !defined(HTTP_CLIENT_SIMDJSON)
+#error "jsonbench parses with simdjson, build it with HTTP_CLIENT_SIMDJSON"
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string url;
+    std::size_t requests = 2000;
+    std::size_t concurrency = 16;
+    std::string array = "items";     // array walked in every response
+    std::string field = "price";     // number summed over its elements
+    int rounds = 3;
+};
+
+struct Result {
+    std::size_t parsed = 0;
+    std::size_t failed = 0;
+    std::size_t bytes = 0;
+    double sum = 0;
+    double cpu_us = 0;
+    double wall_ms = 0;
+};
+
+static void
+usage()
+{
+    std::cerr << "usage: jsonbench URL [--requests N] [--concurrency N] [--rounds N] [--array NAME] [--field NAME]\n"
+                 "  --requests N     responses per mode and round (default 2000)\n"
+                 "  --concurrency N  requests in flight (default 16)\n"
+                 "  --rounds N       rounds, alternating the modes (default 3)\n"
+                 "  --array NAME     array of objects to walk (default items)\n"
+                 "  --field NAME     number field summed over it (default price)\n";
+    std::exit(2);
+}
+
+static Options
+parse_options(int argc, char** argv)
+{
+    Options options;
+    for(int i = 1; i < argc; ++i){
+        std::string arg = argv[i];
+        auto value = [&]{
+            if(++i == argc)
+                usage();
+            return std::string(argv[i]);
+        };
+        if(arg == "--requests")
+            options.requests = std::stoul(value());
+        else if(arg == "--concurrency")
+            options.concurrency = std::stoul(value());
+        else if(arg == "--rounds")
+            options.rounds = std::stoi(value());
+        else if(arg == "--array")
+            options.array = value();
+        else if(arg == "--field")
+            options.field = value();
+        else if(arg[0] == '-' || !options.url.empty())
+            usage();
+        else
+            options.url = arg;
+    }
+    if(options.url.empty() || !options.requests || !options.concurrency)
+        usage();
+    return options;
+}
+
+// The work done on every response, the same in both modes
+static bool
+walk(simdjson::ondemand::document& doc, const Options& options, Result& result)
+{
+    simdjson::ondemand::array items;
+    if(doc[options.array].get_array().get(items))
+        return false;
+    for(auto item : items){
+        double value;
+        if(item[options.field].get_double().get(value))
+            return false;
+        result.sum += value;
+    }
+    return true;
+}
+
+template<class Issue>
+static Result
+run(const Options& options, Issue issue)
+{
+    Result result;
+    std::deque<RequestHandle> in_flight;
+    auto start = Clock::now();
+    auto cpu = std::clock();
+
+    // windowed: the oldest request is waited for once the window is full
+    for(std::size_t i = 0; i < options.requests; ++i){
+        if(in_flight.size() == options.concurrency){
+            in_flight.front().wait();
+            in_flight.pop_front();
+        }
+        in_flight.push_back(issue(result));
+    }
+    for(auto& handle : in_flight)
+        handle.wait();
+
+    result.cpu_us = 1e6 * double(std::clock() - cpu) / CLOCKS_PER_SEC;
+    result.wall_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    return result;
+}
+
+static void
+report(const char* mode, const Result& result)
+{
+    auto responses = result.parsed + result.failed;
+    std::cout << mode
+              << "  responses " << responses
+              << "  failed " << result.failed
+              << "  avg body " << (responses ? result.bytes / responses : 0) << " B"
+              << "  cpu/response " << (responses ? result.cpu_us / responses : 0) << " us"
+              << "  wall " << result.wall_ms << " ms\n";
+}
+
+int
+main(int argc, char** argv)
+{
+    auto options = parse_options(argc, argv);
+    AsyncHttpClient client;
+
+    // callbacks all run on the context's loop thread, so results need no lock
+    auto copied = [&](Result& result){
+        return client.get(options.url).then([&](std::string body){
+            thread_local simdjson::ondemand::parser parser;
+            simdjson::padded_string json(body);
+            result.bytes += body.size();
+            simdjson::ondemand::document doc;
+            if(parser.iterate(json).get(doc) || !walk(doc, options, result))
+                ++result.failed;
+            else
+                ++result.parsed;
+        });
+    };
+    auto in_place = [&](Result& result){
+        return client.get(options.url).then_json([&](JsonResponse& response){
+            result.bytes += response.size();
+            simdjson::ondemand::document doc;
+            if(response.status() != 200 || response.document().get(doc) || !walk(doc, options, result))
+                ++result.failed;
+            else
+                ++result.parsed;
+        });
+    };
+
+    // warm the pool and the buffers before measuring
+    client.preconnect(options.url, options.concurrency).wait();
+    run(options, in_place);
+
+    for(int round = 0; round < options.rounds; ++round){
+        std::cout << "round " << round << "\n";
+        report("  copy + parse", run(options, copied));
+        report("  in place    ", run(options, in_place));
+    }
+    return 0;
+}
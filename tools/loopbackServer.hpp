@@ -0,0 +1,310 @@
+#ifndef LOOPBACK_SERVER_HPP
+#define LOOPBACK_SERVER_HPP
+// What the benchmarks in tools/ measure the client against: a small
+// HTTP/1.1 server on the loopback interface, forked into a process of
+// its own so the benchmark's CPU time is the client's alone. It reads
+// and drops request bodies and answers every request with a body of
+// body_size bytes, or of the size the path asks for ("/65536"), over
+// TCP on a free port, TLS with a throwaway certificate for localhost,
+// or a unix socket. Linux and POSIX only.
+//
+// Start the server before anything starts a thread, contexts included,
+// since it forks.
+
+//include the client's contexts, for routing hosts to the server
+#include "clientContext.hpp"
+//include beast
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+//include openssl, for the throwaway certificate
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+//include others
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace asio = boost::asio;
+namespace ssl = asio::ssl;
+namespace beast = boost::beast;
+namespace http = beast::http;
+using tcp = boost::asio::ip::tcp;
+
+class LoopbackServer
+{
+public:
+    struct Options {
+        std::size_t body_size = 64;     // response body, unless the path has a size
+        bool tls = false;               // serve TLS for localhost
+        std::string unix_path;          // listen on this unix socket instead of TCP
+    };
+
+private:
+    Options options_;
+    pid_t child_ = -1;
+    unsigned short port_ = 0;
+    std::string certificate_;
+    std::string key_;
+
+    // A self-signed certificate for localhost, PEM encoded
+    void
+    make_certificate()
+    {
+        std::unique_ptr<EVP_PKEY_CTX, decltype(&EVP_PKEY_CTX_free)> keygen(EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr), EVP_PKEY_CTX_free);
+        EVP_PKEY* raw = nullptr;
+        if(!keygen || EVP_PKEY_keygen_init(keygen.get()) <= 0
+            || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keygen.get(), NID_X9_62_prime256v1) <= 0
+            || EVP_PKEY_keygen(keygen.get(), &raw) <= 0)
+            throw std::runtime_error("can't generate a key");
+        std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key(raw, EVP_PKEY_free);
+
+        std::unique_ptr<X509, decltype(&X509_free)> cert(X509_new(), X509_free);
+        X509_set_version(cert.get(), 2);
+        ASN1_INTEGER_set(X509_get_serialNumber(cert.get()), 1);
+        X509_gmtime_adj(X509_getm_notBefore(cert.get()), -3600);
+        X509_gmtime_adj(X509_getm_notAfter(cert.get()), 24 * 3600);
+        X509_set_pubkey(cert.get(), key.get());
+        auto name = X509_get_subject_name(cert.get());
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+        X509_set_issuer_name(cert.get(), name);
+
+        X509V3_CTX context;
+        X509V3_set_ctx_nodb(&context);
+        X509V3_set_ctx(&context, cert.get(), cert.get(), nullptr, nullptr, 0);
+        auto names = X509V3_EXT_conf_nid(nullptr, &context, NID_subject_alt_name, const_cast<char*>("DNS:localhost"));
+        X509_add_ext(cert.get(), names, -1);
+        X509_EXTENSION_free(names);
+        if(!X509_sign(cert.get(), key.get(), EVP_sha256()))
+            throw std::runtime_error("can't sign the certificate");
+
+        auto pem = [](const std::function<int(BIO*)>& write){
+            std::unique_ptr<BIO, decltype(&BIO_free)> bio(BIO_new(BIO_s_mem()), BIO_free);
+            write(bio.get());
+            char* data = nullptr;
+            auto size = BIO_get_mem_data(bio.get(), &data);
+            return std::string(data, size);
+        };
+        certificate_ = pem([&](BIO* bio){ return PEM_write_bio_X509(bio, cert.get()); });
+        key_ = pem([&](BIO* bio){ return PEM_write_bio_PrivateKey(bio, key.get(), nullptr, nullptr, 0, nullptr, nullptr); });
+    }
+
+    static unsigned
+    requested_size(beast::string_view target, std::size_t fallback)
+    {
+        auto start = target.find_first_not_of('/');
+        auto digits = start == beast::string_view::npos ? beast::string_view() : target.substr(start);
+        if(digits.empty() || digits.find_first_not_of("0123456789") != beast::string_view::npos)
+            return static_cast<unsigned>(fallback);
+        return static_cast<unsigned>(std::strtoul(std::string(digits).c_str(), nullptr, 10));
+    }
+
+    // One connection, until the client closes it
+    template<class Stream>
+    void
+    serve(Stream& stream)
+    {
+        static const std::string filler(1 << 20, 'x');
+        std::vector<char> chunk(64 * 1024);
+        beast::flat_buffer buffer;
+        beast::error_code ec;
+        for(;;){
+            http::request_parser<http::buffer_body> parser;
+            parser.body_limit(boost::none);
+            http::read_header(stream, buffer, parser, ec);
+            if(ec)
+                return;
+            while(!parser.is_done()){
+                parser.get().body().data = chunk.data();
+                parser.get().body().size = chunk.size();
+                http::read(stream, buffer, parser, ec);
+                if(ec == http::error::need_buffer)
+                    ec = {};
+                if(ec)
+                    return;
+            }
+
+            // small bodies go out with the header in one write
+            auto size = requested_size(parser.get().target(), options_.body_size);
+            if(size <= filler.size()){
+                http::response<http::span_body<const char>> response{http::status::ok, 11};
+                response.set(http::field::content_type, "application/octet-stream");
+                response.body() = {filler.data(), size};
+                response.keep_alive(parser.get().keep_alive());
+                response.prepare_payload();
+                http::write(stream, response, ec);
+                if(ec || !response.keep_alive())
+                    return;
+                continue;
+            }
+
+            // large ones repeat the filler instead of being built
+            http::response<http::buffer_body> response{http::status::ok, 11};
+            response.set(http::field::content_type, "application/octet-stream");
+            response.content_length(size);
+            response.keep_alive(parser.get().keep_alive());
+            http::response_serializer<http::buffer_body> serializer{response};
+            http::write_header(stream, serializer, ec);
+            while(!ec && size){
+                auto n = std::min<std::size_t>(size, filler.size());
+                response.body().data = const_cast<char*>(filler.data());
+                response.body().size = n;
+                response.body().more = size > n;
+                http::write(stream, serializer, ec);
+                if(ec == http::error::need_buffer)
+                    ec = {};
+                size -= static_cast<unsigned>(n);
+            }
+            if(!ec && response.body().more){
+                response.body().data = nullptr;
+                response.body().more = false;
+                http::write(stream, serializer, ec);
+            }
+            if(ec || !response.keep_alive())
+                return;
+        }
+    }
+
+    static void
+    no_delay(tcp::socket& socket)
+    {
+        beast::error_code ignored;
+        socket.set_option(tcp::no_delay(true), ignored);
+    }
+
+    static void
+    no_delay(asio::local::stream_protocol::socket&)
+    {
+    }
+
+    template<class Acceptor>
+    void
+    run(Acceptor& acceptor)
+    {
+        std::unique_ptr<ssl::context> tls;
+        if(options_.tls){
+            tls.reset(new ssl::context(ssl::context::tls_server));
+            tls->use_certificate_chain(asio::buffer(certificate_));
+            tls->use_private_key(asio::buffer(key_), ssl::context::pem);
+        }
+
+        for(;;){
+            typename Acceptor::protocol_type::socket socket(acceptor.get_executor());
+            beast::error_code ec;
+            acceptor.accept(socket, ec);
+            if(ec)
+                continue;
+            no_delay(socket);
+
+            std::thread([this, &tls, socket = std::move(socket)]() mutable {
+                if(!tls)
+                    return serve(socket);
+
+                ssl::stream<decltype(socket)&> stream(socket, *tls);
+                beast::error_code ec;
+                stream.handshake(ssl::stream_base::server, ec);
+                if(!ec)
+                    serve(stream);
+            }).detach();
+        }
+    }
+
+public:
+    explicit
+    LoopbackServer(Options options)
+        : options_(std::move(options))
+    {
+        if(options_.tls)
+            make_certificate();
+
+        // listen before forking, so the port is known and connects queue up
+        int fd;
+        {
+            asio::io_context io;
+            if(options_.unix_path.empty()){
+                tcp::acceptor acceptor(io, tcp::endpoint(asio::ip::make_address("127.0.0.1"), 0));
+                acceptor.listen(asio::socket_base::max_listen_connections);
+                port_ = acceptor.local_endpoint().port();
+                fd = acceptor.release();
+            }else{
+                ::unlink(options_.unix_path.c_str());
+                asio::local::stream_protocol::acceptor acceptor(io, asio::local::stream_protocol::endpoint(options_.unix_path));
+                acceptor.listen(asio::socket_base::max_listen_connections);
+                fd = acceptor.release();
+            }
+        }
+
+        child_ = ::fork();
+        if(child_ < 0)
+            throw std::runtime_error("can't fork the server");
+        if(child_ > 0){
+            ::close(fd);
+            return;
+        }
+
+        asio::io_context io;
+        if(options_.unix_path.empty()){
+            tcp::acceptor acceptor(io, tcp::v4(), fd);
+            run(acceptor);
+        }else{
+            asio::local::stream_protocol::acceptor acceptor(io, asio::local::stream_protocol(), fd);
+            run(acceptor);
+        }
+        std::_Exit(0);
+    }
+
+    LoopbackServer(const LoopbackServer&) = delete;
+    LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+    ~LoopbackServer()
+    {
+        ::kill(child_, SIGKILL);
+        ::waitpid(child_, nullptr, 0);
+        if(!options_.unix_path.empty())
+            ::unlink(options_.unix_path.c_str());
+    }
+
+    unsigned short port() const { return port_; }
+
+    // Send context's requests for host to this server: the DNS cache
+    // answers with its port, and its certificate is trusted
+    void
+    route(ClientContext& context, const std::string& host) const
+    {
+        auto scheme = options_.tls ? "https" : "http";
+        tcp::endpoint endpoint(asio::ip::make_address("127.0.0.1"), port_);
+        context.dns().store(host, scheme, tcp::resolver::results_type::create(endpoint, host, scheme));
+        if(options_.tls)
+            context.ssl().add_certificate_authority(asio::buffer(certificate_));
+    }
+};
+
+// Percentiles of values in milliseconds, one line
+inline void
+print_percentiles(const char* label, std::vector<double> values)
+{
+    if(values.empty()){
+        std::printf("%-22s no samples\n", label);
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    auto at = [&](double p){
+        auto index = static_cast<std::size_t>(p / 100 * (values.size() - 1) + 0.5);
+        return values[index];
+    };
+    std::printf("%-22s p50 %8.3f  p90 %8.3f  p99 %8.3f  max %8.3f ms\n",
+        label, at(50), at(90), at(99), values.back());
+}
+
+#endif // LOOPBACK_SERVER_HPP
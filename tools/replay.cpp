@@ -0,0 +1,243 @@
+// Replays a request log written by RequestRecorder through AsyncHttpClient,
+// open loop: every request is issued at its scheduled time whether or not
+// earlier ones have finished, either at a fixed rate or at the timing of the
+// recording. Latency is measured from the scheduled time, so a stalled
+// client or server shows up in the percentiles instead of slowing the
+// schedule down (coordinated omission). Service time, from the actual send,
+// is reported next to it.
+//
+// Built by CMake against the compiled client (target replay), or by hand:
+//
+//   g++ -std=c++17 -O2 -I. -DHTTP_CLIENT_SEPARATE_COMPILATION tools/replay.cpp httpClient.cpp \
+//       -o replay -lssl -lcrypto -lpthread
+//   ./replay requests.jsonl --rate 500 --count 10000
+//   ./replay requests.jsonl --speed 2
+
+//include the client's declaration, it's compiled into httpClient.cpp
+#include "httpClient.hpp"
+//include json parsing for the log
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+//include others
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace pt = boost::property_tree;
+using Clock = std::chrono::steady_clock;
+
+struct LogEntry {
+    std::int64_t time_us = 0;
+    std::string method;
+    std::string url;
+    Headers headers;
+    std::string body;
+};
+
+struct Sample {
+    Clock::time_point scheduled;
+    Clock::time_point sent;
+    Clock::time_point done;
+    RequestHandle handle;
+};
+
+struct Options {
+    std::string log;
+    double rate = 0;            // requests per second, 0 replays the recorded timing
+    double speed = 1;           // recorded timing is divided by this
+    std::size_t count = 0;      // requests to send, 0 sends the log once
+    double timeout = 30;        // seconds to wait for the last responses
+};
+
+static void
+usage()
+{
+    std::cerr << "usage: replay LOG [--rate N] [--speed X] [--count N] [--timeout S]\n"
+                 "  --rate N     issue N requests per second, cycling through the log\n"
+                 "  --speed X    replay the recorded timing X times faster (default 1)\n"
+                 "  --count N    number of requests to issue (default: the log once)\n"
+                 "  --timeout S  seconds to wait for outstanding responses (default 30)\n";
+    std::exit(2);
+}
+
+static Options
+parse_options(int argc, char** argv)
+{
+    Options options;
+    for(int i = 1; i < argc; ++i){
+        std::string arg = argv[i];
+        auto value = [&]{
+            if(++i == argc)
+                usage();
+            return std::string(argv[i]);
+        };
+        if(arg == "--rate")
+            options.rate = std::stod(value());
+        else if(arg == "--speed")
+            options.speed = std::stod(value());
+        else if(arg == "--count")
+            options.count = std::stoul(value());
+        else if(arg == "--timeout")
+            options.timeout = std::stod(value());
+        else if(options.log.empty() && arg[0] != '-')
+            options.log = arg;
+        else
+            usage();
+    }
+    if(options.log.empty() || options.rate < 0 || options.speed <= 0)
+        usage();
+    return options;
+}
+
+static std::vector<LogEntry>
+read_log(const std::string& path)
+{
+    std::ifstream in(path);
+    if(!in)
+        throw std::runtime_error("can't open " + path);
+
+    std::vector<LogEntry> log;
+    std::string line;
+    while(std::getline(in, line)){
+        if(line.empty())
+            continue;
+
+        std::istringstream text(line);
+        pt::ptree tree;
+        pt::read_json(text, tree);
+
+        LogEntry entry;
+        entry.time_us = tree.get<std::int64_t>("time_us", 0);
+        entry.method = tree.get<std::string>("method");
+        entry.url = tree.get<std::string>("url");
+        entry.body = tree.get<std::string>("body", "");
+        if(auto headers = tree.get_child_optional("headers")){
+            for(auto& header : *headers){
+                entry.headers.insert(header.first, header.second.data());
+            }
+        }
+        log.push_back(std::move(entry));
+    }
+    return log;
+}
+
+static RequestHandle
+issue(AsyncHttpClient& client, const LogEntry& entry, std::function<void(std::string)> callback)
+{
+    if(entry.method == "GET")
+        return client.get(entry.url, entry.headers).then(callback);
+    if(entry.method == "POST")
+        return client.post(entry.url, entry.body.c_str(), entry.headers).then(callback);
+    if(entry.method == "PUT")
+        return client.put(entry.url, entry.body.c_str(), entry.headers).then(callback);
+    return client.delete_(entry.url, entry.headers).then(callback);
+}
+
+static void
+print_percentiles(const char* label, std::vector<double> values)
+{
+    if(values.empty()){
+        std::printf("%-14s no samples\n", label);
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    auto at = [&](double p){
+        auto index = static_cast<std::size_t>(p / 100 * (values.size() - 1) + 0.5);
+        return values[index];
+    };
+    std::printf("%-14s p50 %9.3f  p90 %9.3f  p99 %9.3f  p99.9 %9.3f  max %9.3f ms\n",
+        label, at(50), at(90), at(99), at(99.9), values.back());
+}
+
+int main(int argc, char** argv){
+
+    auto options = parse_options(argc, argv);
+
+    std::vector<LogEntry> log;
+    try{
+        log = read_log(options.log);
+    }catch(std::exception& ex){
+        std::cerr << options.log << ": " << ex.what() << "\n";
+        return 1;
+    }
+
+    // the client only speaks these
+    log.erase(std::remove_if(log.begin(), log.end(), [](const LogEntry& entry){
+        return entry.method != "GET" && entry.method != "POST" && entry.method != "PUT" && entry.method != "DELETE";
+    }), log.end());
+    if(log.empty()){
+        std::cerr << options.log << ": no replayable requests\n";
+        return 1;
+    }
+
+    // the recorded timing covers the log once
+    auto count = options.count ? options.count : log.size();
+    if(options.rate == 0)
+        count = std::min(count, log.size());
+
+    std::vector<Sample> samples(count);
+    AsyncHttpClient client;
+
+    // a moment to set up before the first request is due
+    auto start = Clock::now() + std::chrono::milliseconds(10);
+    auto first_us = log.front().time_us;
+    for(std::size_t i = 0; i < count; ++i){
+        auto& entry = log[i % log.size()];
+
+        std::chrono::duration<double> offset;
+        if(options.rate > 0)
+            offset = std::chrono::duration<double>(i / options.rate);
+        else
+            offset = std::chrono::duration<double>((entry.time_us - first_us) / 1e6 / options.speed);
+
+        // open loop: never wait for earlier requests, only for the schedule
+        auto& sample = samples[i];
+        sample.scheduled = start + std::chrono::duration_cast<Clock::duration>(offset);
+        std::this_thread::sleep_until(sample.scheduled);
+
+        sample.sent = Clock::now();
+        sample.handle = issue(client, entry, [&sample](std::string){
+            sample.done = Clock::now();
+        });
+    }
+    auto issued = Clock::now();
+
+    // wait for the stragglers, then give up on them
+    auto deadline = issued + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.timeout));
+    std::size_t failed = 0;
+    std::size_t timed_out = 0;
+    std::vector<double> latency;
+    std::vector<double> service;
+    std::vector<double> lag;
+    for(auto& sample : samples){
+        if(!sample.handle.wait_for(deadline - Clock::now())){
+            sample.handle.cancel();
+            sample.handle.wait();
+            ++timed_out;
+            continue;
+        }
+        lag.push_back(std::chrono::duration<double, std::milli>(sample.sent - sample.scheduled).count());
+        if(sample.handle.error()){
+            ++failed;
+            continue;
+        }
+        latency.push_back(std::chrono::duration<double, std::milli>(sample.done - sample.scheduled).count());
+        service.push_back(std::chrono::duration<double, std::milli>(sample.done - sample.sent).count());
+    }
+
+    auto elapsed = std::chrono::duration<double>(issued - start).count();
+    std::printf("%zu requests in %.2f s, %.1f req/s offered, %zu ok, %zu failed, %zu timed out\n",
+        count, elapsed, elapsed > 0 ? count / elapsed : 0.0, latency.size(), failed, timed_out);
+    print_percentiles("latency", latency);
+    print_percentiles("service time", service);
+    print_percentiles("send lag", lag);
+
+    return failed || timed_out ? 1 : 0;
+}